@@ -0,0 +1,102 @@
+//for getline and sysconf
+#define _POSIX_C_SOURCE 200809L
+
+#include "midi_batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Reads and parses a corpus of MIDI files and reports the throughput.
+ *
+ * usage: midi_batch [-j threads] [list]
+ * where `list` is a file with one path per line, stdin if it is not given
+ */
+
+struct Counts {
+	uint64_t* events;
+};
+
+static void count_events(const char* path, struct Midi* midi, unsigned worker, void* user){
+	struct Counts* counts = (struct Counts*) user;
+	if(!midi){
+		fprintf(stderr, "could not read %s\n", path);
+		return;
+	}
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		struct MidiTrackChunk* track = midi_chunk_track(midi->chunks[i]);
+		if(track){
+			counts->events[worker] += track->event_count;
+		}
+	}
+}
+
+int main(int argc, char** argv){
+	unsigned threads = 0;
+	const char* list = NULL;
+	for(int i = 1; i < argc; ++i){
+		if(!strcmp(argv[i], "-j") && i + 1 < argc){
+			threads = (unsigned) strtoul(argv[++i], NULL, 10);
+		} else {
+			list = argv[i];
+		}
+	}
+
+	FILE* f = list ? fopen(list, "r") : stdin;
+	if(!f){
+		fprintf(stderr, "could not open %s\n", list);
+		return 1;
+	}
+	char** paths = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	char* line = NULL;
+	size_t line_capacity = 0;
+	ssize_t len;
+	while((len = getline(&line, &line_capacity, f)) >= 0){
+		while(len && (line[len - 1] == '\n' || line[len - 1] == '\r')){
+			line[--len] = '\0';
+		}
+		if(!len){
+			continue;
+		}
+		if(count == capacity){
+			capacity = capacity ? capacity * 2 : 64;
+			paths = realloc(paths, sizeof(char*) * capacity);
+		}
+		paths[count++] = strdup(line);
+	}
+	free(line);
+	if(f != stdin){
+		fclose(f);
+	}
+
+	if(!threads){
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (unsigned) cores : 1;
+	}
+	struct Counts counts;
+	counts.events = calloc(threads, sizeof(uint64_t));
+	struct MidiBatchStats stats;
+	int failed = midi_batch_run((const char* const*) paths, count, threads, count_events, &counts, &stats);
+
+	uint64_t events = 0;
+	for(unsigned i = 0; i < threads; ++i){
+		events += counts.events[i];
+	}
+	printf("files: %zu\n", stats.files);
+	printf("failed: %zu\n", stats.failed);
+	printf("events: %llu\n", (unsigned long long) events);
+	printf("bytes: %llu\n", (unsigned long long) stats.bytes);
+	printf("seconds: %.3f\n", stats.seconds);
+	printf("files/sec: %.1f\n", stats.files_per_sec);
+	printf("MB/sec: %.1f\n", stats.bytes_per_sec / (1024 * 1024));
+
+	for(size_t i = 0; i < count; ++i){
+		free(paths[i]);
+	}
+	free(paths);
+	free(counts.events);
+	return failed ? 1 : 0;
+}
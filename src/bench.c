@@ -0,0 +1,369 @@
+//for clock_gettime and getrusage
+#define _POSIX_C_SOURCE 200809L
+
+#include "midi.h"
+#include "midi_helper.h"
+#include "midi_constants.h"
+#include "midi_transform.h"
+#include "midi_quantize.h"
+#include "bench_corpus.h"
+
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/*
+ * Benchmarks reading and writing a generated corpus, and the varlen and `EventString` helpers.
+ *
+ * usage: midi_bench [-s scale] [-t seconds]
+ * Results are printed as JSON so runs can be diffed between versions. The corpus is written to the working
+ * directory as corpus_*.mid.
+ *
+ * Allocations are counted by linking with -Wl,--wrap=malloc (and calloc and realloc), see `make bench`
+ */
+
+static size_t allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size){
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size){
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p, size_t size){
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_realloc(p, size);
+}
+
+static double now_seconds(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double) t.tv_sec + (double) t.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void){
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/*
+ * What one benchmark measured over all of its iterations
+ */
+struct BenchResult {
+	const char* name;
+	const char* corpus;
+	size_t iterations;
+	double seconds;
+	uint64_t events;
+	uint64_t bytes;
+	size_t allocations;
+};
+
+static int first_result = 1;
+
+static void report(const struct BenchResult* r){
+	double events_per_sec = r->seconds > 0 ? r->events / r->seconds : 0;
+	double mb_per_sec = r->seconds > 0 ? r->bytes / r->seconds / (1024 * 1024) : 0;
+	double allocs_per_event = r->events ? (double) r->allocations / r->events : 0;
+	printf("%s\n    {\"name\": \"%s\", \"corpus\": \"%s\", \"iterations\": %zu, \"seconds\": %.6f, "
+			"\"events_per_sec\": %.0f, \"mb_per_sec\": %.2f, \"allocs_per_event\": %.4f, \"peak_rss_kb\": %ld}",
+			first_result ? "" : ",", r->name, r->corpus, r->iterations, r->seconds,
+			events_per_sec, mb_per_sec, allocs_per_event, peak_rss_kb());
+	first_result = 0;
+}
+
+static uint64_t count_events(struct Midi* midi){
+	uint64_t events = 0;
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		struct MidiTrackChunk* track = midi_chunk_track(midi->chunks[i]);
+		if(track){
+			events += track->event_count;
+		}
+	}
+	return events;
+}
+
+// how long each benchmark repeats for, at least once
+static double min_seconds = 0.5;
+
+#define BENCH_LOOP(result, ...) do { \
+	size_t allocs_before = allocations; \
+	double start = now_seconds(); \
+	do { \
+		__VA_ARGS__; \
+		(result).iterations++; \
+		(result).seconds = now_seconds() - start; \
+	} while((result).seconds < min_seconds); \
+	(result).allocations = allocations - allocs_before; \
+} while(0)
+
+static void bench_file(const char* corpus, struct Midi* midi, unsigned flags){
+	char path[64];
+	snprintf(path, sizeof(path), "corpus_%s.mid", corpus);
+	FILE* f = fopen(path, "wb");
+	write_midi_flags(midi, f, flags);
+	long size = ftell(f);
+	fclose(f);
+	uint64_t events = count_events(midi);
+
+	struct BenchResult read = {"read_midi", corpus, 0, 0, 0, 0, 0};
+	BENCH_LOOP(read, {
+		f = fopen(path, "rb");
+		struct Midi* m = read_midi(f);
+		fclose(f);
+		free_midi(m);
+		free(m);
+	});
+	read.events = events * read.iterations;
+	read.bytes = (uint64_t) size * read.iterations;
+	report(&read);
+
+	uint8_t* data = malloc((size_t) size);
+	f = fopen(path, "rb");
+	if(fread(data, 1, (size_t) size, f) != (size_t) size){
+		fprintf(stderr, "could not read back %s\n", path);
+	}
+	fclose(f);
+	struct BenchResult buffer = {"read_midi_buffer", corpus, 0, 0, 0, 0, 0};
+	BENCH_LOOP(buffer, {
+		struct Midi* m = read_midi_buffer(data, (size_t) size);
+		free_midi(m);
+		free(m);
+	});
+	buffer.events = events * buffer.iterations;
+	buffer.bytes = (uint64_t) size * buffer.iterations;
+	report(&buffer);
+
+	//opening a file to look at its first track, which is the tempo track in a format 1 file
+	struct BenchResult lazy = {"read_midi_buffer_lazy", corpus, 0, 0, 0, 0, 0};
+	uint64_t first_events = 0;
+	BENCH_LOOP(lazy, {
+		struct Midi* m = read_midi_buffer_lazy(data, (size_t) size);
+		first_events += midi_track(m, 0)->event_count;
+		free_midi(m);
+		free(m);
+	});
+	lazy.events = first_events;
+	lazy.bytes = (uint64_t) size * lazy.iterations;
+	report(&lazy);
+	free(data);
+
+	struct BenchResult write = {"write_midi", corpus, 0, 0, 0, 0, 0};
+	f = tmpfile();
+	BENCH_LOOP(write, {
+		rewind(f);
+		write_midi_flags(midi, f, flags);
+	});
+	fclose(f);
+	write.events = events * write.iterations;
+	write.bytes = (uint64_t) size * write.iterations;
+	report(&write);
+
+	struct BenchResult write_buffer = {"write_midi_to_buffer", corpus, 0, 0, 0, 0, 0};
+	uint8_t* out = malloc((size_t) size);
+	BENCH_LOOP(write_buffer, {
+		size_t out_size = (size_t) size;
+		write_midi_to_buffer(midi, flags, out, &out_size);
+	});
+	//the writes above reuse each track's serialized bytes, this encodes every event again
+	struct BenchResult encode = {"write_midi_to_buffer_dirty", corpus, 0, 0, 0, 0, 0};
+	BENCH_LOOP(encode, {
+		for(uint32_t i = 0; i < midi->chunk_count; ++i){
+			if(midi->chunks[i]->type_e == CHUNK_TRACK){
+				track_mark_dirty(midi_chunk_track(midi->chunks[i]));
+			}
+		}
+		size_t out_size = (size_t) size;
+		write_midi_to_buffer(midi, flags, out, &out_size);
+	});
+	encode.events = events * encode.iterations;
+	encode.bytes = (uint64_t) size * encode.iterations;
+	report(&encode);
+	free(out);
+	write_buffer.events = events * write_buffer.iterations;
+	write_buffer.bytes = (uint64_t) size * write_buffer.iterations;
+	report(&write_buffer);
+}
+
+static void bench_transform(const char* corpus, struct Midi* midi){
+	static const char* names[] = {"transform_scalar", "transform_sse2", "transform_avx2"};
+	static const uint8_t map[16] = {1, 0, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+	//the kernels alone, on the columns of every track gathered once
+	struct MidiEventColumns* columns = malloc(sizeof(struct MidiEventColumns) * midi->chunk_count);
+	uint64_t events = 0;
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		new_event_columns(&columns[i]);
+		struct MidiTrackChunk* track = midi_chunk_track(midi->chunks[i]);
+		if(track){
+			event_columns_from_track(&columns[i], track);
+			events += track->event_count;
+		}
+	}
+	for(int isa = TRANSFORM_ISA_SCALAR; isa <= TRANSFORM_ISA_AVX2; ++isa){
+		if(transform_set_isa(isa) != isa){
+			continue;
+		}
+		struct BenchResult transform = {names[isa], corpus, 0, 0, 0, 0, 0};
+		BENCH_LOOP(transform, {
+			for(uint32_t i = 0; i < midi->chunk_count; ++i){
+				event_columns_transpose(&columns[i], (transform.iterations & 1) ? -7 : 7, ALL_CHANNELS);
+				event_columns_velocity_scale(&columns[i], 140, -2);
+				event_columns_channel_remap(&columns[i], map);
+				event_columns_filter(&columns[i], CLASS_ALL & ~CLASS_CONTROLLER);
+			}
+		});
+		transform.events = events * transform.iterations;
+		transform.bytes = events * 4 * transform.iterations;
+		report(&transform);
+	}
+	transform_set_isa(-1);
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		free_event_columns(&columns[i]);
+	}
+	free(columns);
+}
+
+static void bench_rescale(const char* corpus, struct Midi* midi){
+	uint64_t events = count_events(midi);
+	uint16_t division = midi->header->division;
+	//doubling the division and halving it again is exact, so every iteration does the same work
+	struct BenchResult serial = {"midi_rescale_division", corpus, 0, 0, 0, 0, 0};
+	BENCH_LOOP(serial, {
+		midi_rescale_division(midi, midi->header->division == division ? division * 2 : division);
+	});
+	serial.events = events * serial.iterations;
+	serial.bytes = events * sizeof(uint32_t) * serial.iterations;
+	report(&serial);
+
+	struct BenchResult parallel = {"midi_rescale_division_parallel", corpus, 0, 0, 0, 0, 0};
+	BENCH_LOOP(parallel, {
+		midi_rescale_division_parallel(midi, midi->header->division == division ? division * 2 : division, 0);
+	});
+	midi_rescale_division(midi, division);
+	parallel.events = events * parallel.iterations;
+	parallel.bytes = events * sizeof(uint32_t) * parallel.iterations;
+	report(&parallel);
+}
+
+static void bench_varlen(void){
+	//a spread of lengths, mostly short like real delta times
+	const size_t count = 1 << 20;
+	uint8_t* encoded = malloc(count * VARLEN_MAX_LEN);
+	struct BenchRandom random;
+	bench_random_seed(&random, 1);
+	size_t len = 0;
+	for(size_t i = 0; i < count; ++i){
+		uint32_t r = bench_random(&random);
+		uint32_t value = (r & 0x3) ? r >> 25 : (r & 0x4) ? r >> 18 : r >> 4;
+		len += varlen_encode(value, encoded + len);
+	}
+
+	struct BenchResult decode = {"varlen_to_int", "random", 0, 0, 0, 0, 0};
+	volatile uint32_t sink = 0;
+	BENCH_LOOP(decode, {
+		size_t pos = 0;
+		uint32_t sum = 0;
+		while(pos < len){
+			size_t size;
+			sum += varlen_to_int(encoded + pos, &size);
+			pos += size;
+		}
+		sink += sum;
+	});
+	decode.events = (uint64_t) count * decode.iterations;
+	decode.bytes = (uint64_t) len * decode.iterations;
+	report(&decode);
+
+	struct BenchResult encode = {"varlen_encode", "random", 0, 0, 0, 0, 0};
+	BENCH_LOOP(encode, {
+		size_t pos = 0;
+		bench_random_seed(&random, 1);
+		for(size_t i = 0; i < count; ++i){
+			pos += varlen_encode(bench_random(&random) >> 4, encoded + pos);
+		}
+		sink += encoded[pos - 1];
+	});
+	encode.events = (uint64_t) count * encode.iterations;
+	encode.bytes = (uint64_t) count * 4 * encode.iterations;
+	report(&encode);
+	free(encoded);
+	(void) sink;
+}
+
+static void bench_event_string(void){
+	const size_t count = 100000;
+	struct BenchResult build = {"event_string", "note_and_meta", 0, 0, 0, 0, 0};
+	uint64_t bytes = 0;
+	BENCH_LOOP(build, {
+		for(size_t i = 0; i < count; ++i){
+			struct EventString ev;
+			new_event_string(&ev);
+			if(i & 7){
+				add_voice_message(&ev, VOICE_NOTE_ON, i & 0x0F);
+				add_byte(&ev, i & 0x7F);
+				add_byte(&ev, 0x40);
+			} else {
+				add_meta_message(&ev, META_TRACK_NAME);
+				add_string(&ev, "Acoustic Grand Piano", 20);
+			}
+			bytes += ev.event_string_len;
+			free_event_string(&ev);
+		}
+	});
+	build.events = (uint64_t) count * build.iterations;
+	build.bytes = bytes;
+	report(&build);
+}
+
+int main(int argc, char** argv){
+	size_t scale = 1;
+	for(int i = 1; i + 1 < argc; i += 2){
+		if(!strcmp(argv[i], "-s")){
+			scale = (size_t) strtoul(argv[i + 1], NULL, 10);
+		} else if(!strcmp(argv[i], "-t")){
+			min_seconds = strtod(argv[i + 1], NULL);
+		}
+	}
+	if(!scale){
+		scale = 1;
+	}
+
+	printf("{\n  \"scale\": %zu,\n  \"benchmarks\": [", scale);
+
+	struct Midi* midi = corpus_dense_piano(1, 200000 * scale);
+	bench_file("dense_piano", midi, 0);
+	bench_transform("dense_piano", midi);
+	free_midi(midi);
+	free(midi);
+
+	midi = corpus_drums(2, 200000 * scale);
+	bench_file("drums", midi, WRITE_COMPACT);
+	free_midi(midi);
+	free(midi);
+
+	midi = corpus_sysex(3, 16 * scale, 256 * 1024);
+	bench_file("sysex", midi, 0);
+	free_midi(midi);
+	free(midi);
+
+	midi = corpus_orchestral(4, 128, 2000 * scale);
+	bench_file("orchestral", midi, WRITE_RUNNING_STATUS);
+	bench_rescale("orchestral", midi);
+	free_midi(midi);
+	free(midi);
+
+	bench_varlen();
+	bench_event_string();
+
+	printf("\n  ],\n  \"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+	return 0;
+}
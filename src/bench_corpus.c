@@ -0,0 +1,157 @@
+#include "bench_corpus.h"
+#include "midi_constants.h"
+#include "midi_helper.h"
+
+#include <string.h>
+
+void bench_random_seed(struct BenchRandom* random, uint64_t seed){
+	//xorshift never leaves 0
+	random->state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+uint32_t bench_random(struct BenchRandom* random){
+	uint64_t x = random->state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	random->state = x;
+	return (uint32_t) (x >> 32);
+}
+
+static struct Midi* corpus_new(uint16_t format, uint16_t tracks){
+	struct Midi* midi = malloc(sizeof(struct Midi));
+	new_midi(midi);
+	midi_reserve_chunks(midi, tracks + 1);
+	midi_add_header(midi, format, tracks, 480);
+	return midi;
+}
+
+static void corpus_end_track(struct MidiTrackChunk* track){
+	uint8_t end[3] = {0xFF, META_END_OF_TRACK, 0x00};
+	track_add_event_full(track, 0, end, 3);
+}
+
+struct Midi* corpus_dense_piano(uint64_t seed, size_t events){
+	struct BenchRandom random;
+	bench_random_seed(&random, seed);
+	struct Midi* midi = corpus_new(0, 1);
+	struct MidiTrackChunk* track = midi_add_track(midi);
+	track_reserve(track, events + 1);
+
+	//notes which are still sounding, released in the order they were struck
+	uint8_t held[16];
+	size_t held_count = 0;
+	for(size_t i = 0; i < events; ++i){
+		uint32_t r = bench_random(&random);
+		uint32_t delta = (r & 3) ? 0 : 1 + (r >> 8) % 120;
+		if(held_count == 16 || (held_count && (r & 0x10))){
+			uint8_t ev[3] = {VOICE_NOTE_OFF, held[0], 0x40};
+			memmove(held, held + 1, --held_count);
+			track_add_event_full(track, delta, ev, 3);
+		} else {
+			uint8_t note = 36 + (r >> 16) % 60;
+			uint8_t ev[3] = {VOICE_NOTE_ON, note, 20 + (r >> 24) % 100};
+			held[held_count++] = note;
+			track_add_event_full(track, delta, ev, 3);
+		}
+	}
+	corpus_end_track(track);
+	return midi;
+}
+
+struct Midi* corpus_drums(uint64_t seed, size_t events){
+	struct BenchRandom random;
+	bench_random_seed(&random, seed);
+	struct Midi* midi = corpus_new(0, 1);
+	struct MidiTrackChunk* track = midi_add_track(midi);
+	track_reserve(track, events + 1);
+
+	const uint8_t kit[6] = {NOTE_C2, NOTE_D2, NOTE_FS2, NOTE_AS2, NOTE_CS3, NOTE_DS3};
+	for(size_t i = 0; i + 1 < events; i += 2){
+		uint32_t r = bench_random(&random);
+		uint8_t note = kit[r % 6];
+		uint8_t hit[3] = {VOICE_NOTE_ON | CHANNEL_9, note, 60 + (r >> 8) % 60};
+		uint8_t release[3] = {VOICE_NOTE_ON | CHANNEL_9, note, 0};
+		track_add_event_full(track, (r >> 16) % 4 ? 0 : 120, hit, 3);
+		track_add_event_full(track, 0, release, 3);
+	}
+	corpus_end_track(track);
+	return midi;
+}
+
+struct Midi* corpus_sysex(uint64_t seed, size_t dumps, size_t dump_len){
+	struct BenchRandom random;
+	bench_random_seed(&random, seed);
+	struct Midi* midi = corpus_new(0, 1);
+	struct MidiTrackChunk* track = midi_add_track(midi);
+
+	uint8_t* dump = malloc(sizeof(uint8_t) * dump_len);
+	for(size_t d = 0; d < dumps; ++d){
+		for(size_t i = 0; i + 1 < dump_len; ++i){
+			dump[i] = bench_random(&random) & 0x7F;
+		}
+		dump[dump_len - 1] = 0xF7;
+
+		struct EventString ev;
+		new_event_string(&ev);
+		add_sysex_message(&ev, 0xF0);
+		add_buffer(&ev, dump, dump_len);
+		track_add_event_full(track, 480, ev.event_string, ev.event_string_len);
+		free_event_string(&ev);
+	}
+	free(dump);
+	corpus_end_track(track);
+	return midi;
+}
+
+struct Midi* corpus_orchestral(uint64_t seed, uint16_t tracks, size_t events_per_track){
+	struct BenchRandom random;
+	bench_random_seed(&random, seed);
+	struct Midi* midi = corpus_new(1, tracks + 1);
+
+	struct MidiTrackChunk* tempo_track = midi_add_track(midi);
+	for(uint32_t bar = 0; bar < 64; ++bar){
+		struct EventString ev;
+		new_event_string(&ev);
+		add_meta_message(&ev, META_SET_TEMPO);
+		add_byte(&ev, 3);
+		uint32_t tempo = 400000 + bench_random(&random) % 200000;
+		add_byte(&ev, tempo >> 16);
+		add_byte(&ev, tempo >> 8);
+		add_byte(&ev, tempo);
+		track_add_event_full(tempo_track, bar ? 4 * 480 : 0, ev.event_string, ev.event_string_len);
+		free_event_string(&ev);
+	}
+	corpus_end_track(tempo_track);
+
+	for(uint16_t t = 0; t < tracks; ++t){
+		struct MidiTrackChunk* track = midi_add_track(midi);
+		track_reserve(track, events_per_track + 1);
+		uint8_t channel = t % 16;
+		uint8_t note = 0;
+		for(size_t i = 0; i < events_per_track; ++i){
+			uint32_t r = bench_random(&random);
+			uint32_t delta = 30 * (1 + r % 8);
+			if(r & 0x300){
+				//alternate note ons and offs
+				if(note){
+					uint8_t ev[3] = {VOICE_NOTE_OFF | channel, note, 0x40};
+					track_add_event_full(track, delta, ev, 3);
+					note = 0;
+				} else {
+					note = 40 + (r >> 10) % 48;
+					uint8_t ev[3] = {VOICE_NOTE_ON | channel, note, 40 + (r >> 20) % 80};
+					track_add_event_full(track, delta, ev, 3);
+				}
+			} else if(r & 0x400){
+				uint8_t ev[3] = {VOICE_CONTROLLER_CHANGE | channel, 1 + (r >> 11) % 10, (r >> 20) & 0x7F};
+				track_add_event_full(track, delta, ev, 3);
+			} else {
+				uint8_t ev[3] = {VOICE_PITCH_BEND | channel, (r >> 11) & 0x7F, (r >> 20) & 0x7F};
+				track_add_event_full(track, delta, ev, 3);
+			}
+		}
+		corpus_end_track(track);
+	}
+	return midi;
+}
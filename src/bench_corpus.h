@@ -0,0 +1,39 @@
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include "midi.h"
+
+/*
+ * Generates synthetic MIDI files which look like real ones, for benchmarking.
+ *
+ * Everything is driven by a seeded xorshift generator, so the same seed gives the same file on every machine and
+ * benchmark runs can be compared between versions.
+ * The returned `Midi` is allocated and should be freed with `free_midi` and `free`.
+ */
+
+struct BenchRandom {
+	uint64_t state;
+};
+
+void bench_random_seed(struct BenchRandom* random, uint64_t seed);
+uint32_t bench_random(struct BenchRandom* random);
+
+/*
+ * A single piano track of overlapping chords and runs with varied velocities and short delta times
+ */
+struct Midi* corpus_dense_piano(uint64_t seed, size_t events);
+/*
+ * A drum track on channel 10 where every event is a note on (hits, and velocity 0 releases), so nearly all of it
+ * uses running status once written with WRITE_COMPACT
+ */
+struct Midi* corpus_drums(uint64_t seed, size_t events);
+/*
+ * A track of `dumps` sysex dumps of `dump_len` bytes, like a synth's patch banks
+ */
+struct Midi* corpus_sysex(uint64_t seed, size_t dumps, size_t dump_len);
+/*
+ * A format 1 file with a tempo track and `tracks` instrument tracks of notes, controller changes and pitch bends
+ */
+struct Midi* corpus_orchestral(uint64_t seed, uint16_t tracks, size_t events_per_track);
+
+#endif /* BENCH_CORPUS_H */
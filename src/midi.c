@@ -1,3 +1,6 @@
+//for mmap, open and fstat
+#define _POSIX_C_SOURCE 200809L
+
 #include "midi.h"
 #include "midi_constants.h"
 
@@ -7,6 +10,16 @@
 #include <stdio.h>
 
 #include <assert.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 //for htonl 
 #if __has_include(<netinet/in.h>)
@@ -63,33 +76,269 @@ uint32_t varlen_to_int (const uint8_t* var, size_t* size) {
 	return val;	
 }
 
-uint8_t* int_to_varlen(uint32_t val, size_t* _size)	{
-	uint32_t val2 = val;
-	//determine the necessary size of the variable length quantity
-	size_t count = 1;
-	while(val2 >>= 1){
-		count++;
+int varlen_to_int_checked(const uint8_t* var, size_t avail, uint32_t* val, size_t* size){
+	if(avail > VARLEN_MAX_LEN){
+		avail = VARLEN_MAX_LEN;
+	}
+	uint32_t v = 0;
+	for(size_t i = 0; i < avail; ++i){
+		v = (v << 7) | (var[i] & 0x7F);
+		if(!(var[i] >> 7)){
+			(*val) = v;
+			(*size) = i + 1;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+size_t varlen_size(uint32_t val){
+	//each comparison adds one byte for each further set of 7 bits
+	//values past VARLEN_MAX are written as VARLEN_MAX, so never take more than VARLEN_MAX_LEN bytes
+	return 1 + (val >= (1u << 7)) + (val >= (1u << 14)) + (val >= (1u << 21));
+}
+
+size_t varlen_encode(uint32_t val, uint8_t* var){
+	assert(val <= VARLEN_MAX);
+	if(val > VARLEN_MAX){
+		val = VARLEN_MAX;
 	}
+	size_t size = varlen_size(val);
+	//the lowest set of 7 is the last byte, and is the only one without its MSB set
+	var[size - 1] = val & 0x7F;
+	for(size_t i = size - 1; i > 0; --i){
+		val >>= 7;
+		var[i - 1] = (val & 0x7F) | 0x80;
+	}
+	return size;
+}
 
-	//determine the number of sets of 7 there are
-	size_t size = count / 7 + (count % 7 ? 1 : 0);
-	uint8_t* var = malloc(sizeof(uint8_t) * size);
+uint8_t* int_to_varlen(uint32_t val, size_t* _size)	{
+	uint8_t* var = malloc(sizeof(uint8_t) * varlen_size(val));
+	size_t size = varlen_encode(val, var);
 	if(_size){
 		(*_size) = size;
 	}
+	return var;
+}
+
+struct MidiArenaBlock {
+	struct MidiArenaBlock* next;
+	size_t size;
+	size_t used;
+};
+
+//the block bookkeeping is padded so the data that follows it stays aligned
+#define ARENA_BLOCK_HEADER ((sizeof(struct MidiArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void new_arena(struct MidiArena* arena, size_t block_size){
+	arena->blocks = NULL;
+	arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
 
-	for(size_t i = 0; i < size; ++i){
-		//zero out the MSB
-		var[size - i - 1] = val & 0x7F;
-		if(i){
-			//if this is not the lowest byte
-			//then set the MSB to 1
-			var[size - i - 1] |= 0x80;
+void free_arena(struct MidiArena* arena){
+	struct MidiArenaBlock* block = arena->blocks;
+	while(block){
+		struct MidiArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+}
+
+void* arena_alloc(struct MidiArena* arena, size_t size){
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	struct MidiArenaBlock* block = arena->blocks;
+	if(!block || block->size - block->used < size){
+		size_t block_size = size > arena->block_size ? size : arena->block_size;
+		struct MidiArenaBlock* fresh = malloc(ARENA_BLOCK_HEADER + block_size);
+		fresh->size = block_size;
+		fresh->used = 0;
+		if(block && size > arena->block_size){
+			//oversized requests get their own block behind the current one 
+			//so the space left in the current block is not wasted
+			fresh->next = block->next;
+			block->next = fresh;
+		} else {
+			fresh->next = block;
+			arena->blocks = fresh;
 		}
-		//do next set of 7
-		val >>= 7;
+		block = fresh;
 	}
-	return var;
+	void* p = (uint8_t*) block + ARENA_BLOCK_HEADER + block->used;
+	block->used += size;
+	return p;
+}
+
+/*
+ * A payload held by a `MidiPayloadPool`, chained into its bucket
+ */
+struct MidiPayload {
+	struct MidiPayload* next;
+	struct MidiPayloadPool* pool;
+	uint64_t hash;
+	size_t refs;
+
+	size_t len;
+	uint8_t data[];
+};
+
+void new_payload_pool(struct MidiPayloadPool* pool){
+	pool->bucket_count = POOL_BUCKETS;
+	pool->buckets = calloc(pool->bucket_count, sizeof(struct MidiPayload*));
+	pthread_mutex_init(&pool->lock, NULL);
+	memset(&pool->stats, 0, sizeof(pool->stats));
+}
+
+void free_payload_pool(struct MidiPayloadPool* pool){
+	for(size_t i = 0; i < pool->bucket_count; ++i){
+		struct MidiPayload* payload = pool->buckets[i];
+		while(payload){
+			struct MidiPayload* next = payload->next;
+			free(payload);
+			payload = next;
+		}
+	}
+	free(pool->buckets);
+	pool->buckets = NULL;
+	pool->bucket_count = 0;
+	pthread_mutex_destroy(&pool->lock);
+	memset(&pool->stats, 0, sizeof(pool->stats));
+}
+
+/*
+ * Hashes 8 bytes at a time, since the payloads worth pooling are at least that long
+ */
+static uint64_t payload_hash(const uint8_t* data, size_t len){
+	uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+	size_t i = 0;
+	for(; i + 8 <= len; i += 8){
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 32;
+	}
+	for(; i < len; ++i){
+		h = (h ^ data[i]) * 0x100000001B3ULL;
+	}
+	h ^= h >> 29;
+	return h * 0xC4CEB9FE1A85EC53ULL;
+}
+
+static void pool_grow(struct MidiPayloadPool* pool){
+	size_t bucket_count = pool->bucket_count * 2;
+	struct MidiPayload** buckets = calloc(bucket_count, sizeof(struct MidiPayload*));
+	for(size_t i = 0; i < pool->bucket_count; ++i){
+		struct MidiPayload* payload = pool->buckets[i];
+		while(payload){
+			struct MidiPayload* next = payload->next;
+			size_t b = payload->hash & (bucket_count - 1);
+			payload->next = buckets[b];
+			buckets[b] = payload;
+			payload = next;
+		}
+	}
+	free(pool->buckets);
+	pool->buckets = buckets;
+	pool->bucket_count = bucket_count;
+}
+
+const uint8_t* payload_pool_intern(struct MidiPayloadPool* pool, const uint8_t* data, size_t len){
+	uint64_t hash = payload_hash(data, len);
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.references++;
+	pool->stats.referenced_bytes += len;
+	struct MidiPayload* payload = pool->buckets[hash & (pool->bucket_count - 1)];
+	for(; payload; payload = payload->next){
+		if(payload->hash == hash && payload->len == len && !memcmp(payload->data, data, len)){
+			payload->refs++;
+			pthread_mutex_unlock(&pool->lock);
+			return payload->data;
+		}
+	}
+	if(pool->stats.payloads >= pool->bucket_count){
+		pool_grow(pool);
+	}
+	payload = malloc(sizeof(struct MidiPayload) + len);
+	payload->pool = pool;
+	payload->hash = hash;
+	payload->refs = 1;
+	payload->len = len;
+	memcpy(payload->data, data, len);
+	size_t b = hash & (pool->bucket_count - 1);
+	payload->next = pool->buckets[b];
+	pool->buckets[b] = payload;
+	pool->stats.payloads++;
+	pool->stats.payload_bytes += len;
+	pthread_mutex_unlock(&pool->lock);
+	return payload->data;
+}
+
+/*
+ * Takes another reference to a payload already held, without looking it up again
+ */
+static void payload_pool_retain(const uint8_t* data){
+	struct MidiPayload* payload = (struct MidiPayload*) (data - offsetof(struct MidiPayload, data));
+	struct MidiPayloadPool* pool = payload->pool;
+	pthread_mutex_lock(&pool->lock);
+	payload->refs++;
+	pool->stats.references++;
+	pool->stats.referenced_bytes += payload->len;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void payload_pool_release(const uint8_t* data){
+	struct MidiPayload* payload = (struct MidiPayload*) (data - offsetof(struct MidiPayload, data));
+	struct MidiPayloadPool* pool = payload->pool;
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.references--;
+	pool->stats.referenced_bytes -= payload->len;
+	if(--payload->refs){
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+	struct MidiPayload** link = &pool->buckets[payload->hash & (pool->bucket_count - 1)];
+	while(*link != payload){
+		link = &(*link)->next;
+	}
+	(*link) = payload->next;
+	pool->stats.payloads--;
+	pool->stats.payload_bytes -= payload->len;
+	pthread_mutex_unlock(&pool->lock);
+	free(payload);
+}
+
+void payload_pool_stats(struct MidiPayloadPool* pool, struct MidiPoolStats* stats){
+	pthread_mutex_lock(&pool->lock);
+	(*stats) = pool->stats;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void* midi_alloc(struct MidiArena* arena, size_t size){
+	return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+/*
+ * Reallocates an array of `count` elements to hold `capacity` elements.
+ * Arena memory cannot be realloc'd, so arena backed arrays are copied into a new allocation instead
+ */
+static void* resize_array(struct MidiArena* arena, void* array, size_t count, size_t capacity, size_t elem_size){
+	if(!arena){
+		return realloc(array, elem_size * capacity);
+	}
+	void* resized = arena_alloc(arena, elem_size * capacity);
+	if(count){
+		memcpy(resized, array, elem_size * count);
+	}
+	return resized;
+}
+
+/*
+ * The capacity an array should grow to when it is full. 
+ * Doubling keeps appending N elements O(N) overall
+ */
+static size_t grown_capacity(size_t capacity){
+	return capacity ? capacity * 2 : 4;
 }
 
 void new_midichunk(struct MidiChunk* chunk, enum ChunkType type){
@@ -101,6 +350,9 @@ void new_midichunk(struct MidiChunk* chunk, enum ChunkType type){
 	chunk->type_e = type;
 
 	chunk->chunk = NULL;
+	chunk->pending = NULL;
+	chunk->pending_len = 0;
+	chunk->malformed = 0;
 }
 
 void free_midichunk(struct MidiChunk* chunk){
@@ -111,6 +363,10 @@ void free_midichunk(struct MidiChunk* chunk){
 		header = NULL;
 	} else {
 		struct MidiTrackChunk* track = (struct MidiTrackChunk*) chunk->chunk;
+		//a track shared with a clone is freed by the last Midi holding it
+		if(__atomic_sub_fetch(&track->refs, 1, __ATOMIC_ACQ_REL)){
+			return;
+		}
 		free_midi_track(track);
 		free(track);
 		track = NULL;
@@ -119,11 +375,36 @@ void free_midichunk(struct MidiChunk* chunk){
 
 void new_midi(struct Midi* midi) {
 	midi->chunk_count = 0;
-	midi->chunks = malloc(sizeof(struct MidiChunk*) * midi->chunk_count);
+	midi->chunk_capacity = 0;
+	midi->chunks = NULL;
 	midi->header = NULL;
+	midi->arena = NULL;
+	midi->pool = NULL;
+}
+
+void new_midi_arena(struct Midi* midi, size_t block_size){
+	new_midi(midi);
+	midi->arena = malloc(sizeof(struct MidiArena));
+	new_arena(midi->arena, block_size);
 }
 
 void free_midi(struct Midi* midi){
+	if(midi->arena){
+		//everything else lives in the arena, so only the serialized tracks need freeing
+		for(size_t i = 0; i < midi->chunk_count; ++i){
+			if(midi->chunks[i]->type_e == CHUNK_TRACK){
+				free_midi_track((struct MidiTrackChunk*) midi->chunks[i]->chunk);
+			}
+		}
+		free_arena(midi->arena);
+		free(midi->arena);
+		midi->arena = NULL;
+		midi->chunks = NULL;
+		midi->chunk_count = 0;
+		midi->chunk_capacity = 0;
+		midi->header = NULL;
+		return;
+	}
 	for(size_t i = 0; i < midi->chunk_count;++i){
 		free_midichunk(midi->chunks[i]);
 		free(midi->chunks[i]);
@@ -131,13 +412,42 @@ void free_midi(struct Midi* midi){
 	}
 	free(midi->chunks);
 	midi->chunks = NULL;
+	midi->chunk_count = 0;
+	midi->chunk_capacity = 0;
+}
+
+void midi_reserve_chunks(struct Midi* midi, uint32_t capacity){
+	if(capacity <= midi->chunk_capacity){
+		return;
+	}
+	midi->chunks = resize_array(midi->arena, midi->chunks, midi->chunk_count, capacity, sizeof(struct MidiChunk*));
+	midi->chunk_capacity = capacity;
+}
+
+void midi_shrink_to_fit(struct Midi* midi){
+	if(midi->arena){
+		return;
+	}
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		struct MidiTrackChunk* track = (struct MidiTrackChunk*) midi->chunks[i]->chunk;
+		//a shared track may be in use by a clone
+		if(midi->chunks[i]->type_e == CHUNK_TRACK && __atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1){
+			track_shrink_to_fit(track);
+		}
+	}
+	if(midi->chunk_count < midi->chunk_capacity){
+		midi->chunks = realloc(midi->chunks, sizeof(struct MidiChunk*) * midi->chunk_count);
+		midi->chunk_capacity = midi->chunk_count;
+	}
 }
 
 struct MidiChunk* midi_add_chunk(struct Midi* midi){
+	if(midi->chunk_count == midi->chunk_capacity){
+		midi_reserve_chunks(midi, grown_capacity(midi->chunk_capacity));
+	}
 	midi->chunk_count++;
-	midi->chunks = realloc(midi->chunks, sizeof(struct MidiChunk*) * midi->chunk_count);
 
-	struct MidiChunk* chunk = malloc(sizeof(struct MidiChunk));
+	struct MidiChunk* chunk = midi_alloc(midi->arena, sizeof(struct MidiChunk));
 	midi->chunks[midi->chunk_count - 1] = chunk;
 	return chunk;
 }
@@ -149,7 +459,7 @@ struct MidiHeaderChunk* midi_add_header(struct Midi* midi, uint16_t format, uint
 
 	struct MidiChunk* chunk = midi_add_chunk(midi);
 	new_midichunk(chunk, CHUNK_HEADER);
-	struct MidiHeaderChunk* header = malloc(sizeof(struct MidiHeaderChunk));
+	struct MidiHeaderChunk* header = midi_alloc(midi->arena, sizeof(struct MidiHeaderChunk));
 	new_midi_header(header, HEADER_LEN, format, tracks, division);
 	chunk->chunk = header;
 	midi->header = header;
@@ -159,8 +469,10 @@ struct MidiHeaderChunk* midi_add_header(struct Midi* midi, uint16_t format, uint
 struct MidiTrackChunk* midi_add_track(struct Midi* midi){
 	struct MidiChunk* chunk = midi_add_chunk(midi);
 	new_midichunk(chunk, CHUNK_TRACK);
-	struct MidiTrackChunk* track = malloc(sizeof(struct MidiTrackChunk));
+	struct MidiTrackChunk* track = midi_alloc(midi->arena, sizeof(struct MidiTrackChunk));
 	new_midi_track(track);
+	track->arena = midi->arena;
+	track->pool = midi->arena ? NULL : midi->pool;
 	chunk->chunk = track;
 	return track;
 }
@@ -179,30 +491,107 @@ void free_midi_header(struct MidiHeaderChunk* header){
 
 void new_midi_event(struct MidiEvent* event, uint32_t delta_time, const uint8_t* ev, size_t event_length){
 	event->delta_time = delta_time;
-	event->event = malloc(sizeof(uint8_t) * event_length);
 	event->event_len = event_length;
-	memcpy(event->event, ev, event_length);
+	if(event_length <= EVENT_INLINE_LEN){
+		event->storage = EVENT_STORAGE_INLINE;
+		memcpy(event->data.bytes, ev, event_length);
+	} else {
+		event->storage = EVENT_STORAGE_OWNED;
+		event->data.ptr = malloc(sizeof(uint8_t) * event_length);
+		memcpy(event->data.ptr, ev, event_length);
+	}
+}
+
+const uint8_t* midi_event_data(const struct MidiEvent* event){
+	return event->storage == EVENT_STORAGE_INLINE ? event->data.bytes : event->data.ptr;
+}
+
+uint8_t* midi_event_data_mutable(struct MidiEvent* event){
+	if(event->storage == EVENT_STORAGE_BORROWED || event->storage == EVENT_STORAGE_POOLED){
+		uint8_t* data = malloc(sizeof(uint8_t) * event->event_len);
+		memcpy(data, event->data.ptr, event->event_len);
+		if(event->storage == EVENT_STORAGE_POOLED){
+			payload_pool_release(event->data.ptr);
+		}
+		event->storage = EVENT_STORAGE_OWNED;
+		event->data.ptr = data;
+	}
+	return event->storage == EVENT_STORAGE_INLINE ? event->data.bytes : event->data.ptr;
+}
+
+void new_midi_event_borrowed(struct MidiEvent* event, uint32_t delta_time, const uint8_t* ev, size_t event_length){
+	event->delta_time = delta_time;
+	event->storage = EVENT_STORAGE_BORROWED;
+	//the event never writes through this pointer
+	event->data.ptr = (uint8_t*) ev;
+	event->event_len = event_length;
+}
+
+void new_midi_event_pooled(struct MidiEvent* event, struct MidiPayloadPool* pool, uint32_t delta_time, const uint8_t* ev, size_t event_length){
+	if(event_length <= EVENT_INLINE_LEN){
+		new_midi_event(event, delta_time, ev, event_length);
+		return;
+	}
+	event->delta_time = delta_time;
+	event->storage = EVENT_STORAGE_POOLED;
+	//shared with every other event holding the same bytes, so it is never written through
+	event->data.ptr = (uint8_t*) payload_pool_intern(pool, ev, event_length);
+	event->event_len = event_length;
 }
 
 void free_midi_event(struct MidiEvent* event){
-	free(event->event);
-	event->event = NULL;
+	if(event->storage == EVENT_STORAGE_OWNED){
+		free(event->data.ptr);
+	} else if(event->storage == EVENT_STORAGE_POOLED){
+		payload_pool_release(event->data.ptr);
+	}
+	event->storage = EVENT_STORAGE_INLINE;
+	event->event_len = 0;
 }
 
+/*
+ * The size of a voice event indexed by the high nibble of its status byte
+ */
+static const uint8_t voice_event_size[16] = {
+	0, 0, 0, 0, 0, 0, 0, 0,
+	3, 3, 3, 3, 2, 2, 3, 0
+};
+
 struct MidiEvent* parse_midi_event(const uint8_t* event, size_t* size_read){
+	uint8_t running_status = 0;
+	return parse_midi_event_running(event, size_read, &running_status);
+}
+
+struct MidiEvent* parse_midi_event_running(const uint8_t* event, size_t* size_read, uint8_t* running_status){
 	size_t delta_time_size;
 	uint32_t delta_time = varlen_to_int(event, &delta_time_size);
 	const uint8_t* event_code = event + delta_time_size;
 	uint8_t event_type = event_code[0];
 
+	//the event with its status byte filled in if it uses running status
+	uint8_t status_event[3];
 	size_t event_size;
 	if((event_type & 0xF0) < 0x80){
-		//this should be an error...
-		//no wait. it should jsut add to the previous event.
-		//fuck running status
+		//running status, the status byte is left out and repeats the last voice event's
+		if(!(*running_status)){
+			if(size_read){
+				(*size_read) = 0;
+			}
+			return NULL;
+		}
+		event_size = voice_event_size[(*running_status) >> 4] - 1;
+		status_event[0] = *running_status;
+		memcpy(status_event + 1, event_code, event_size);
+		struct MidiEvent* e = malloc(sizeof(struct MidiEvent));
+		new_midi_event(e, delta_time, status_event, event_size + 1);
+		if(size_read){
+			(*size_read) = event_size + delta_time_size;
+		}
+		return e;
 	} else if((event_type & 0xF0) < 0xF0){
 		//this is a midi voice or mode message
 		event_size = parse_midi_voice_event(event_code);
+		(*running_status) = event_type;
 	} else {
 		if((event_type == 0xF0) || event_type == 0xF7){
 			//this is a sysex message (<type> <len> <data>)
@@ -254,50 +643,292 @@ size_t parse_midi_meta_event(const uint8_t* event_code){
 
 void new_midi_track(struct MidiTrackChunk* track){
 	track->event_count = 0;
+	track->event_capacity = 0;
 
-	track->events = malloc(sizeof(struct MidiEvent*) * track ->event_count);
+	track->events = NULL;
+
+	track->event_block = NULL;
+	track->block_count = 0;
+
+	track->arena = NULL;
+	track->pool = NULL;
+
+	track->ticks = NULL;
+	track->ticks_valid = 0;
+	track->ticks_capacity = 0;
+
+	track->serialized = NULL;
+	track->serialized_len = 0;
+	track->serialized_flags = 0;
+	track->dirty = 1;
+
+	track->refs = 1;
 }
 
 void free_midi_track(struct MidiTrackChunk* track){
+	//never allocated from the arena
+	free(track->serialized);
+	track->serialized = NULL;
+	track->serialized_len = 0;
+	track->dirty = 1;
+	if(track->arena){
+		//the events are freed along with the rest of the arena, but bytes given to them by `new_midi_event` are not
+		for(size_t i = 0; i < track->event_count; ++i){
+			free_midi_event(track->events[i]);
+		}
+		track->events = NULL;
+		track->event_block = NULL;
+		track->ticks = NULL;
+		return;
+	}
 	for(size_t i = 0; i < track->event_count; ++i){
 		free_midi_event(track->events[i]);
-		free(track->events[i]);
+		if(i >= track->block_count){
+			free(track->events[i]);
+		}
 		track->events[i] = NULL;
 	}
 	free(track->events);
 	track->events = NULL;
+	track->event_count = 0;
+	track->event_capacity = 0;
+	free(track->event_block);
+	track->event_block = NULL;
+	track->block_count = 0;
+	free(track->ticks);
+	track->ticks = NULL;
+	track->ticks_valid = 0;
+	track->ticks_capacity = 0;
+}
+
+void track_reserve(struct MidiTrackChunk* track, size_t capacity){
+	//a track shared with a clone has to be fetched with midi_track_writable first
+	assert(__atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1);
+	if(capacity <= track->event_capacity){
+		return;
+	}
+	track->events = resize_array(track->arena, track->events, track->event_count, capacity, sizeof(struct MidiEvent*));
+	track->event_capacity = capacity;
+}
+
+void track_shrink_to_fit(struct MidiTrackChunk* track){
+	assert(__atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1);
+	if(track->arena){
+		return;
+	}
+	//the tick cache is rebuilt on demand
+	free(track->ticks);
+	track->ticks = NULL;
+	track->ticks_valid = 0;
+	track->ticks_capacity = 0;
+	if(track->event_count == track->event_capacity){
+		return;
+	}
+	track->events = realloc(track->events, sizeof(struct MidiEvent*) * track->event_count);
+	track->event_capacity = track->event_count;
+}
+
+const uint64_t* track_ticks(struct MidiTrackChunk* track){
+	size_t n = track->event_count;
+	//a shared track always has every tick cached by `midi_clone`, so this is all clones reading it do
+	if(track->ticks_valid == n){
+		return track->ticks;
+	}
+	assert(__atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1);
+	if(track->ticks_capacity < n){
+		//sized like the events so appending does not regrow it every time
+		track->ticks = resize_array(track->arena, track->ticks, track->ticks_valid, track->event_capacity, sizeof(uint64_t));
+		track->ticks_capacity = track->event_capacity;
+	}
+	uint64_t* ticks = track->ticks;
+	size_t i = track->ticks_valid;
+	uint64_t tick = i ? ticks[i - 1] : 0;
+
+	//gather the delta times first so the sum runs over a contiguous array
+	for(size_t j = i; j < n; ++j){
+		ticks[j] = track->events[j]->delta_time;
+	}
+	//sum four at a time within a block, then carry the running total in, so only one add per block
+	//depends on the previous block
+	for(; i + 4 <= n; i += 4){
+		uint64_t a = ticks[i];
+		uint64_t b = a + ticks[i + 1];
+		uint64_t c = ticks[i + 2];
+		uint64_t d = c + ticks[i + 3];
+		c += b;
+		d += b;
+		ticks[i] = tick + a;
+		ticks[i + 1] = tick + b;
+		ticks[i + 2] = tick + c;
+		ticks[i + 3] = tick + d;
+		tick += d;
+	}
+	for(; i < n; ++i){
+		tick += ticks[i];
+		ticks[i] = tick;
+	}
+	track->ticks_valid = n;
+	return ticks;
+}
+
+void track_invalidate_ticks(struct MidiTrackChunk* track, size_t from){
+	assert(__atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1);
+	track->dirty = 1;
+	if(from < track->ticks_valid){
+		track->ticks_valid = from;
+	}
+}
+
+size_t track_find_tick(struct MidiTrackChunk* track, uint64_t tick){
+	const uint64_t* ticks = track_ticks(track);
+	size_t low = 0;
+	size_t high = track->event_count;
+	while(low < high){
+		size_t mid = low + (high - low) / 2;
+		if(ticks[mid] < tick){
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
 }
 
 size_t track_length(struct MidiTrackChunk* track){
+	return track_length_flags(track, 0);
+}
+
+size_t track_length_flags(struct MidiTrackChunk* track, unsigned flags){
+	//known without encoding anything once the track has been written unchanged with these flags
+	if(!track->dirty && track->serialized_flags == flags){
+		return track->serialized_len;
+	}
 	size_t s = 0;
+	uint8_t running_status = 0;
 	for(size_t i = 0; i < track->event_count; ++i){
 		struct MidiEvent* e = track->events[i];
-		size_t sz;
-		free(int_to_varlen(e->delta_time, &sz));
-		s += sz;
-		s += e->event_len;
+		s += varlen_size(e->delta_time);
+		if(flags){
+			uint8_t scratch[3];
+			size_t len;
+			midi_event_encoding(midi_event_data(e), e->event_len, flags, &running_status, scratch, &len);
+			s += len;
+		} else {
+			s += e->event_len;
+		}
 	}
 	return s;
 }
 
-struct MidiEvent* track_add_event(struct MidiTrackChunk* track){
-	track->event_count++;
-	track->events = realloc(track->events, sizeof(struct MidiEvent*) * track->event_count);
+/*
+ * Encodes the events of the track into `out`, which has room for them. Returns the end of what was written
+ */
+static uint8_t* store_track_events(const struct MidiTrackChunk* track, unsigned flags, uint8_t* out){
+	uint8_t running_status = 0;
+	for(size_t i = 0; i < track->event_count; ++i){
+		struct MidiEvent* e = track->events[i];
+		out += varlen_encode(e->delta_time, out);
+		uint8_t scratch[3];
+		size_t event_len;
+		const uint8_t* ev = midi_event_encoding(midi_event_data(e), e->event_len, flags, &running_status, scratch, &event_len);
+		memcpy(out, ev, event_len);
+		out += event_len;
+	}
+	return out;
+}
 
-	struct MidiEvent* event = malloc(sizeof(struct MidiEvent));
-	track->events[track->event_count - 1] = event;
+/*
+ * Whether the track's bytes as written with `flags` are kept, so it can be written with a single copy
+ */
+static int track_kept(const struct MidiTrackChunk* track, unsigned flags){
+	return !track->dirty && track->serialized && track->serialized_flags == flags;
+}
+
+/*
+ * Whether the track is shared with a clone. Clones may be writing it on other threads, so nothing it caches is
+ * updated while it is shared
+ */
+static int track_shared(const struct MidiTrackChunk* track){
+	return __atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) != 1;
+}
+
+/*
+ * Whether the track is being written a second time unchanged, which is when its bytes start being kept. A Midi
+ * written once, e.g. one just built, never pays for keeping a copy
+ */
+static int track_keeps(const struct MidiTrackChunk* track, unsigned flags){
+	return !track->dirty && !track->serialized && track->serialized_flags == flags && !track_shared(track);
+}
+
+/*
+ * Records that the track was just written with `flags`, as `len` bytes which are kept if `bytes` is set
+ */
+static void track_written(struct MidiTrackChunk* track, unsigned flags, const uint8_t* bytes, size_t len){
+	if(track_shared(track)){
+		return;
+	}
+	free(track->serialized);
+	track->serialized = NULL;
+	if(bytes){
+		//always allocated outside of any arena, since it is replaced every time the track changes
+		track->serialized = malloc(len ? len : 1);
+		memcpy(track->serialized, bytes, len);
+	}
+	track->serialized_len = len;
+	track->serialized_flags = flags;
+	track->dirty = 0;
+}
+
+const uint8_t* track_serialized(struct MidiTrackChunk* track, unsigned flags, size_t* len){
+	if(!track_kept(track, flags)){
+		if(track_shared(track)){
+			return NULL;
+		}
+		size_t size = track_length_flags(track, flags);
+		uint8_t* bytes = malloc(size ? size : 1);
+		store_track_events(track, flags, bytes);
+		free(track->serialized);
+		track->serialized = bytes;
+		track->serialized_len = size;
+		track->serialized_flags = flags;
+		track->dirty = 0;
+	}
+	(*len) = track->serialized_len;
+	return track->serialized;
+}
+
+void track_mark_dirty(struct MidiTrackChunk* track){
+	assert(__atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1);
+	track->dirty = 1;
+}
+
+struct MidiEvent* track_add_event(struct MidiTrackChunk* track){
+	struct MidiEvent* event = midi_alloc(track->arena, sizeof(struct MidiEvent));
+	track_add_event_existing(track, event);
 	return event;
 }
 
 struct MidiEvent* track_add_event_full(struct MidiTrackChunk* track, uint32_t delta_time, const uint8_t* event_data, size_t event_data_len){
 	struct MidiEvent* event = track_add_event(track);
-	new_midi_event(event, delta_time, event_data, event_data_len);
+	if(track->arena && event_data_len > EVENT_INLINE_LEN){
+		uint8_t* data = arena_alloc(track->arena, event_data_len);
+		memcpy(data, event_data, event_data_len);
+		new_midi_event_borrowed(event, delta_time, data, event_data_len);
+	} else if(track->pool){
+		new_midi_event_pooled(event, track->pool, delta_time, event_data, event_data_len);
+	} else {
+		new_midi_event(event, delta_time, event_data, event_data_len);
+	}
 	return event;
 }
 
 void track_add_event_existing(struct MidiTrackChunk* track, struct MidiEvent* event){
+	assert(__atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1);
+	if(track->event_count == track->event_capacity){
+		track_reserve(track, grown_capacity(track->event_capacity));
+	}
+	track->dirty = 1;
 	track->event_count++;
-	track->events = realloc(track->events, sizeof(struct MidiEvent*) * track->event_count);
 
 	track->events[track->event_count - 1] = event;
 }
@@ -324,7 +955,19 @@ uint32_t read_uint32_t(FILE* f){
 	return ntohl(d);
 }
 
+/*
+ * The track to write for a chunk, where a lazily read track which turned out to be malformed is written empty
+ */
+static struct MidiTrackChunk* written_track(struct MidiChunk* chunk){
+	struct MidiTrackChunk* track = midi_chunk_track(chunk);
+	return track ? track : (struct MidiTrackChunk*) chunk->chunk;
+}
+
 void write_midi(struct Midi* midi, FILE* f) {
+	write_midi_flags(midi, f, 0);
+}
+
+void write_midi_flags(struct Midi* midi, FILE* f, unsigned flags) {
 	for(uint32_t i = 0; i < midi->chunk_count; ++i){
 		struct MidiChunk* chunk = midi->chunks[i];
 		fwrite(chunk->type, sizeof(uint8_t), TYPE_LEN, f);
@@ -335,20 +978,261 @@ void write_midi(struct Midi* midi, FILE* f) {
 			write_uint16_t(header->tracks, f);
 			write_uint16_t(header->division, f);
 		} else {
-			struct MidiTrackChunk* track = (struct MidiTrackChunk*) chunk->chunk;
-			write_uint32_t(track_length(track), f);
-			for(size_t i = 0; i < track->event_count; ++i){
-				size_t time_size;
-				uint8_t* time = int_to_varlen(track->events[i]->delta_time, &time_size);
-				fwrite(time, sizeof(uint8_t), time_size, f);
-				fwrite(track->events[i]->event, sizeof(uint8_t), track->events[i]->event_len, f);
-				free(time);
-				time = NULL;
+			struct MidiTrackChunk* track = written_track(chunk);
+			size_t len;
+			if(track_kept(track, flags) || track_keeps(track, flags)){
+				const uint8_t* events = track_serialized(track, flags, &len);
+				write_uint32_t((uint32_t) len, f);
+				fwrite(events, sizeof(uint8_t), len, f);
+				continue;
 			}
+			len = track_length_flags(track, flags);
+			write_uint32_t((uint32_t) len, f);
+			uint8_t running_status = 0;
+			for(size_t e = 0; e < track->event_count; ++e){
+				struct MidiEvent* event = track->events[e];
+				uint8_t time[VARLEN_MAX_LEN];
+				fwrite(time, sizeof(uint8_t), varlen_encode(event->delta_time, time), f);
+				uint8_t scratch[3];
+				size_t event_len;
+				const uint8_t* ev = midi_event_encoding(midi_event_data(event), event->event_len, flags, &running_status, scratch, &event_len);
+				fwrite(ev, sizeof(uint8_t), event_len, f);
+			}
+			track_written(track, flags, NULL, len);
 		}
 	}
 }
 
+size_t midi_length_flags(struct Midi* midi, unsigned flags){
+	size_t s = 0;
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		struct MidiChunk* chunk = midi->chunks[i];
+		s += TYPE_LEN + 4;
+		if(chunk->type_e == CHUNK_HEADER){
+			s += HEADER_LEN;
+		} else {
+			s += track_length_flags(written_track(chunk), flags);
+		}
+	}
+	return s;
+}
+
+static uint8_t* store_uint16_t(uint16_t data, uint8_t* out){
+	out[0] = data >> 8;
+	out[1] = data;
+	return out + 2;
+}
+
+static uint8_t* store_uint32_t(uint32_t data, uint8_t* out){
+	out[0] = data >> 24;
+	out[1] = data >> 16;
+	out[2] = data >> 8;
+	out[3] = data;
+	return out + 4;
+}
+
+/*
+ * Serializes the header chunk including its type and length, which takes TYPE_LEN + 4 + HEADER_LEN bytes
+ */
+static uint8_t* store_header(const struct MidiChunk* chunk, uint8_t* out){
+	const struct MidiHeaderChunk* header = (const struct MidiHeaderChunk*) chunk->chunk;
+	memcpy(out, chunk->type, TYPE_LEN);
+	out = store_uint32_t(header->length, out + TYPE_LEN);
+	out = store_uint16_t(header->format, out);
+	out = store_uint16_t(header->tracks, out);
+	return store_uint16_t(header->division, out);
+}
+
+uint8_t* write_midi_to_buffer(struct Midi* midi, unsigned flags, uint8_t* buffer, size_t* size){
+	size_t needed = midi_length_flags(midi, flags);
+	if(buffer && (*size) < needed){
+		(*size) = needed;
+		return NULL;
+	}
+	if(!buffer){
+		buffer = malloc(needed ? needed : 1);
+	}
+	(*size) = needed;
+
+	uint8_t* out = buffer;
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		struct MidiChunk* chunk = midi->chunks[i];
+		if(chunk->type_e == CHUNK_HEADER){
+			out = store_header(chunk, out);
+			continue;
+		}
+		struct MidiTrackChunk* track = written_track(chunk);
+		memcpy(out, chunk->type, TYPE_LEN);
+		//the length is filled in once the events are written, rather than sizing the track a second time
+		uint8_t* length = out + TYPE_LEN;
+		out += TYPE_LEN + 4;
+		uint8_t* body = out;
+		if(track_kept(track, flags)){
+			memcpy(out, track->serialized, track->serialized_len);
+			out += track->serialized_len;
+		} else {
+			//encoded straight into the buffer, and only copied to be kept if the track is written unchanged again
+			out = store_track_events(track, flags, out);
+			track_written(track, flags, track_keeps(track, flags) ? body : NULL, (size_t) (out - body));
+		}
+		store_uint32_t((uint32_t) (out - body), length);
+	}
+	return buffer;
+}
+
+// how many bytes of headers, delta times and short events are gathered before they are written
+#define WRITEV_STAGE_LEN 65536
+// events at least this long are written from the event rather than copied into the staging buffer
+#define WRITEV_DIRECT_LEN 64
+#if defined(IOV_MAX) && IOV_MAX < 256
+#define WRITEV_IOV_LEN IOV_MAX
+#else
+#define WRITEV_IOV_LEN 256
+#endif
+
+struct FdWriter {
+	int fd;
+	int failed;
+
+	struct iovec iov[WRITEV_IOV_LEN];
+	int iov_count;
+
+	uint8_t stage[WRITEV_STAGE_LEN];
+	size_t stage_len;
+};
+
+static void fd_writer_flush(struct FdWriter* w){
+	struct iovec* iov = w->iov;
+	int count = w->iov_count;
+	while(count && !w->failed){
+		ssize_t n = writev(w->fd, iov, count);
+		if(n < 0){
+			if(errno != EINTR){
+				w->failed = 1;
+			}
+			continue;
+		}
+		//skip what was written, which may end part way through a buffer
+		size_t written = (size_t) n;
+		while(count && written >= iov->iov_len){
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count){
+			iov->iov_base = (uint8_t*) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	w->iov_count = 0;
+	w->stage_len = 0;
+}
+
+static void fd_writer_iov(struct FdWriter* w, const uint8_t* data, size_t len){
+	if(w->iov_count == WRITEV_IOV_LEN){
+		fd_writer_flush(w);
+	}
+	w->iov[w->iov_count].iov_base = (void*) data;
+	w->iov[w->iov_count].iov_len = len;
+	w->iov_count++;
+}
+
+/*
+ * Returns room for `len` (at most WRITEV_STAGE_LEN) bytes in the staging buffer, which are written out in order
+ * with everything else
+ */
+static uint8_t* fd_writer_stage(struct FdWriter* w, size_t len){
+	if(w->stage_len + len > WRITEV_STAGE_LEN){
+		fd_writer_flush(w);
+	}
+	uint8_t* p = w->stage + w->stage_len;
+	struct iovec* last = w->iov_count ? &w->iov[w->iov_count - 1] : NULL;
+	if(last && (uint8_t*) last->iov_base + last->iov_len == p){
+		//carries on from the last staged bytes
+		last->iov_len += len;
+	} else {
+		if(w->iov_count == WRITEV_IOV_LEN){
+			fd_writer_flush(w);
+			p = w->stage;
+		}
+		fd_writer_iov(w, p, len);
+	}
+	w->stage_len += len;
+	return p;
+}
+
+int write_midi_fd(struct Midi* midi, int fd, unsigned flags){
+	struct FdWriter* w = malloc(sizeof(struct FdWriter));
+	w->fd = fd;
+	w->failed = 0;
+	w->iov_count = 0;
+	w->stage_len = 0;
+
+	for(uint32_t i = 0; i < midi->chunk_count && !w->failed; ++i){
+		struct MidiChunk* chunk = midi->chunks[i];
+		if(chunk->type_e == CHUNK_HEADER){
+			store_header(chunk, fd_writer_stage(w, TYPE_LEN + 4 + HEADER_LEN));
+			continue;
+		}
+		struct MidiTrackChunk* track = written_track(chunk);
+		size_t len;
+		const uint8_t* events = NULL;
+		if(track_kept(track, flags) || track_keeps(track, flags)){
+			events = track_serialized(track, flags, &len);
+		} else {
+			len = track_length_flags(track, flags);
+		}
+		uint8_t* head = fd_writer_stage(w, TYPE_LEN + 4);
+		memcpy(head, chunk->type, TYPE_LEN);
+		store_uint32_t((uint32_t) len, head + TYPE_LEN);
+		if(events){
+			//the kept bytes are written without being copied
+			if(len){
+				fd_writer_iov(w, events, len);
+			}
+			continue;
+		}
+
+		uint8_t running_status = 0;
+		for(size_t e = 0; e < track->event_count; ++e){
+			struct MidiEvent* event = track->events[e];
+			uint8_t time[VARLEN_MAX_LEN];
+			size_t time_size = varlen_encode(event->delta_time, time);
+			memcpy(fd_writer_stage(w, time_size), time, time_size);
+
+			uint8_t scratch[3];
+			size_t event_len;
+			const uint8_t* ev = midi_event_encoding(midi_event_data(event), event->event_len, flags, &running_status, scratch, &event_len);
+			if(event_len >= WRITEV_DIRECT_LEN){
+				fd_writer_iov(w, ev, event_len);
+			} else {
+				memcpy(fd_writer_stage(w, event_len), ev, event_len);
+			}
+		}
+		track_written(track, flags, NULL, len);
+	}
+	fd_writer_flush(w);
+	int failed = w->failed;
+	free(w);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Reads past the body of a chunk which is not a track, without relying on being able to seek.
+ * Returns 0 on success and -1 if the file ends first
+ */
+static int skip_chunk(FILE* f, uint32_t size){
+	uint8_t skipped[256];
+	while(size){
+		size_t n = size < sizeof(skipped) ? size : sizeof(skipped);
+		if(fread(skipped, sizeof(uint8_t), n, f) != n){
+			return -1;
+		}
+		size -= (uint32_t) n;
+	}
+	return 0;
+}
+
 struct Midi* read_midi(FILE* f){	
 	struct Midi* midi = malloc(sizeof(struct Midi));
 	new_midi(midi);
@@ -363,20 +1247,31 @@ struct Midi* read_midi(FILE* f){
 	uint16_t tracks = read_uint16_t(f);
 	uint16_t division = read_uint16_t(f);
 
+	midi_reserve_chunks(midi, tracks + 1);
 	midi_add_header(midi, format, tracks, division);
-	for(size_t i = 0; i < tracks; ++i){
+	for(size_t i = 0; i < tracks;){
 		fread(chunk_head, sizeof(uint8_t), TYPE_LEN, f);
 		uint32_t size_track = read_uint32_t(f);
+		if(memcmp(chunk_head, "MTrk", TYPE_LEN)){
+			skip_chunk(f, size_track);
+			continue;
+		}
+		i++;
 		struct MidiTrackChunk* track = midi_add_track(midi);
 
 		//read all the events in the track
 		uint8_t* event = malloc(sizeof(uint8_t) * size_track);
 		fread(event, sizeof(uint8_t), size_track, f);
+		//counting the events first means the track only has to be sized once
+		track_reserve(track, decode_delta_times(event, size_track, NULL, SIZE_MAX));
 
 		size_t read = 0;
+		uint8_t running_status = 0;
 		while(1){
 			size_t event_size;
-			struct MidiEvent* e = parse_midi_event((event + read), &event_size);
+			struct MidiEvent* e = parse_midi_event_running((event + read), &event_size, &running_status);
+			//an event without a status byte and no running status to use
+			assert(e);
 			track_add_event_existing(track, e);
 			read += event_size;
 			if(read == size_track){
@@ -393,3 +1288,576 @@ struct Midi* read_midi(FILE* f){
 	}
 	return midi;
 }
+
+/*
+ * Bounds checked version of the parse_midi_*_event functions.
+ *
+ * This is used when parsing memory we cannot trust to be well formed (i.e. a mapped file)
+ * It returns 0 on success and -1 if reading would go past `avail` bytes.
+ */
+static int event_size_bounded(const uint8_t* event_code, size_t avail, uint8_t* running_status, size_t* size){
+	if(!avail){
+		return -1;
+	}
+	uint8_t event_type = event_code[0];
+	size_t event_size;
+	if((event_type & 0xF0) < 0x80){
+		if(!running_status || !(*running_status)){
+			return -1;
+		}
+		//only the data bytes are present
+		event_size = voice_event_size[(*running_status) >> 4] - 1;
+	} else if((event_type & 0xF0) < 0xF0){
+		event_size = voice_event_size[event_type >> 4];
+		if(running_status){
+			(*running_status) = event_type;
+		}
+	} else {
+		//sysex is <type> <len> <data>, meta is <type> <subtype> <len> <data>
+		//neither is allowed to use running status, but some files expect it to survive them so it is left alone
+		size_t prefix = ((event_type == 0xF0) || event_type == 0xF7) ? 1 : 2;
+		uint32_t len;
+		size_t len_size;
+		if(avail < prefix || varlen_to_int_checked(event_code + prefix, avail - prefix, &len, &len_size)){
+			return -1;
+		}
+		event_size = prefix + len_size + len;
+	}
+	if(event_size > avail){
+		return -1;
+	}
+	(*size) = event_size;
+	return 0;
+}
+
+int parse_midi_event_bounds(const uint8_t* event, size_t avail, uint8_t* running_status, uint32_t* delta_time, size_t* delta_time_size, size_t* event_size){
+	if(varlen_to_int_checked(event, avail, delta_time, delta_time_size)){
+		return -1;
+	}
+	return event_size_bounded(event + (*delta_time_size), avail - (*delta_time_size), running_status, event_size);
+}
+
+const uint8_t* midi_event_with_status(const uint8_t* event, size_t* event_len, uint8_t running_status, uint8_t* scratch){
+	if(event[0] & 0x80){
+		return event;
+	}
+	scratch[0] = running_status;
+	memcpy(scratch + 1, event, *event_len);
+	(*event_len)++;
+	return scratch;
+}
+
+const uint8_t* midi_event_encoding(const uint8_t* event, size_t event_len, unsigned flags, uint8_t* running_status, uint8_t* scratch, size_t* out_len){
+	(*out_len) = event_len;
+	uint8_t status = event_len ? event[0] : 0;
+	if(status < 0x80 || status >= 0xF0){
+		//sysex and meta events cancel running status
+		(*running_status) = 0;
+		return event;
+	}
+	if((flags & WRITE_NOTE_OFF_AS_NOTE_ON) && (status & 0xF0) == VOICE_NOTE_OFF && event_len == 3){
+		scratch[0] = VOICE_NOTE_ON | (status & 0x0F);
+		scratch[1] = event[1];
+		scratch[2] = 0;
+		event = scratch;
+		status = scratch[0];
+	}
+	if((flags & WRITE_RUNNING_STATUS) && status == (*running_status)){
+		(*out_len) = event_len - 1;
+		return event + 1;
+	}
+	(*running_status) = status;
+	return event;
+}
+
+size_t decode_delta_times(const uint8_t* data, size_t len, uint32_t* delta_times, size_t max){
+	size_t count = 0;
+	size_t read = 0;
+	uint8_t running_status = 0;
+	while(read < len && count < max){
+		uint32_t delta_time;
+		size_t delta_time_size;
+		//most delta times are a single byte
+		if(!(data[read] & 0x80)){
+			delta_time = data[read];
+			delta_time_size = 1;
+		} else if(varlen_to_int_checked(data + read, len - read, &delta_time, &delta_time_size)){
+			break;
+		}
+		read += delta_time_size;
+		if(read >= len){
+			break;
+		}
+
+		//and most events are voice events whose size only depends on the status byte
+		uint8_t status = data[read];
+		size_t event_size = voice_event_size[status >> 4];
+		if(event_size){
+			running_status = status;
+		} else if(event_size_bounded(data + read, len - read, &running_status, &event_size)){
+			break;
+		}
+		if(event_size > len - read){
+			break;
+		}
+		read += event_size;
+
+		if(delta_times){
+			delta_times[count] = delta_time;
+		}
+		count++;
+	}
+	return count;
+}
+
+uint16_t load_uint16_t(const uint8_t* data){
+	return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+uint32_t load_uint32_t(const uint8_t* data){
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+/*
+ * Parses the events of an empty track chunk into a single block of `MidiEvent`s.
+ * If `borrow` is set the events point into `data` wherever they can, otherwise they are copied.
+ *
+ * The events are counted first so the block and the `events` array are each allocated once
+ */
+static int parse_track_block(struct MidiTrackChunk* track, const uint8_t* data, size_t len, int borrow){
+	size_t count = 0;
+	size_t read = 0;
+	uint8_t running_status = 0;
+	while(read < len){
+		uint32_t delta_time;
+		size_t delta_time_size;
+		size_t event_size;
+		if(parse_midi_event_bounds(data + read, len - read, &running_status, &delta_time, &delta_time_size, &event_size)){
+			return -1;
+		}
+		read += delta_time_size + event_size;
+		count++;
+	}
+
+	track_reserve(track, count);
+	track->event_block = midi_alloc(track->arena, sizeof(struct MidiEvent) * count);
+	track->block_count = count;
+
+	read = 0;
+	running_status = 0;
+	for(size_t i = 0; i < count; ++i){
+		uint32_t delta_time;
+		size_t delta_time_size;
+		size_t event_size;
+		parse_midi_event_bounds(data + read, len - read, &running_status, &delta_time, &delta_time_size, &event_size);
+		const uint8_t* event_code = data + read + delta_time_size;
+		read += delta_time_size + event_size;
+
+		struct MidiEvent* e = &track->event_block[i];
+		if(borrow && (event_code[0] & 0x80)){
+			new_midi_event_borrowed(e, delta_time, event_code, event_size);
+		} else {
+			//when borrowing, only events whose status byte has to be filled in are copied. They are small enough to be stored inline
+			uint8_t scratch[3];
+			const uint8_t* ev = midi_event_with_status(event_code, &event_size, running_status, scratch);
+			if(track->pool){
+				new_midi_event_pooled(e, track->pool, delta_time, ev, event_size);
+			} else {
+				new_midi_event(e, delta_time, ev, event_size);
+			}
+		}
+		track->events[i] = e;
+		track->event_count++;
+	}
+	return 0;
+}
+
+/*
+ * A track waiting to be decoded by `parse_midi_buffer`
+ */
+struct TrackJob {
+	struct MidiTrackChunk* track;
+	const uint8_t* data;
+	uint32_t len;
+	int failed;
+};
+
+struct TrackJobs {
+	struct TrackJob* jobs;
+	size_t count;
+	size_t next;
+	int borrow;
+};
+
+static void* parse_track_worker(void* arg){
+	struct TrackJobs* jobs = (struct TrackJobs*) arg;
+	size_t i;
+	while((i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED)) < jobs->count){
+		struct TrackJob* job = &jobs->jobs[i];
+		job->failed = parse_track_block(job->track, job->data, job->len, jobs->borrow);
+	}
+	return NULL;
+}
+
+static int compare_track_jobs(const void* a, const void* b){
+	uint32_t len_a = ((const struct TrackJob*) a)->len;
+	uint32_t len_b = ((const struct TrackJob*) b)->len;
+	return (len_a < len_b) - (len_a > len_b);
+}
+
+struct MidiTrackChunk* midi_chunk_track(struct MidiChunk* chunk){
+	if(chunk->type_e != CHUNK_TRACK || chunk->malformed){
+		return NULL;
+	}
+	struct MidiTrackChunk* track = (struct MidiTrackChunk*) chunk->chunk;
+	if(chunk->pending){
+		const uint8_t* data = chunk->pending;
+		chunk->pending = NULL;
+		if(parse_track_block(track, data, chunk->pending_len, 1)){
+			//drop whatever was decoded before the error
+			struct MidiArena* arena = track->arena;
+			struct MidiPayloadPool* pool = track->pool;
+			free_midi_track(track);
+			new_midi_track(track);
+			track->arena = arena;
+			track->pool = pool;
+			chunk->malformed = 1;
+			return NULL;
+		}
+	}
+	return track;
+}
+
+struct MidiTrackChunk* midi_track(struct Midi* midi, uint32_t index){
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		if(midi->chunks[i]->type_e == CHUNK_TRACK && !index--){
+			return midi_chunk_track(midi->chunks[i]);
+		}
+	}
+	return NULL;
+}
+
+struct Midi* midi_clone(struct Midi* midi){
+	if(midi->arena){
+		return NULL;
+	}
+	struct Midi* clone = malloc(sizeof(struct Midi));
+	new_midi(clone);
+	clone->pool = midi->pool;
+	midi_reserve_chunks(clone, midi->chunk_count);
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		struct MidiChunk* chunk = midi->chunks[i];
+		if(chunk->type_e == CHUNK_HEADER){
+			struct MidiHeaderChunk* header = (struct MidiHeaderChunk*) chunk->chunk;
+			midi_add_header(clone, header->format, header->tracks, header->division);
+			continue;
+		}
+		//decoded and its ticks cached up front, since filling in either once the track is shared would change it
+		//under the other Midis
+		midi_chunk_track(chunk);
+		struct MidiTrackChunk* track = (struct MidiTrackChunk*) chunk->chunk;
+		track_ticks(track);
+		__atomic_add_fetch(&track->refs, 1, __ATOMIC_RELAXED);
+
+		struct MidiChunk* shared = midi_add_chunk(clone);
+		new_midichunk(shared, CHUNK_TRACK);
+		shared->chunk = track;
+		shared->malformed = chunk->malformed;
+	}
+	return clone;
+}
+
+/*
+ * Copies a track's events into a single block, sharing the bytes of long events wherever they can be
+ */
+static struct MidiTrackChunk* copy_track(const struct MidiTrackChunk* track){
+	struct MidiTrackChunk* copy = malloc(sizeof(struct MidiTrackChunk));
+	new_midi_track(copy);
+	copy->pool = track->pool;
+	size_t count = track->event_count;
+	track_reserve(copy, count);
+	copy->event_block = malloc(sizeof(struct MidiEvent) * (count ? count : 1));
+	copy->block_count = count;
+	for(size_t i = 0; i < count; ++i){
+		struct MidiEvent* from = track->events[i];
+		struct MidiEvent* e = &copy->event_block[i];
+		if(from->storage == EVENT_STORAGE_OWNED){
+			if(copy->pool){
+				new_midi_event_pooled(e, copy->pool, from->delta_time, from->data.ptr, from->event_len);
+			} else {
+				new_midi_event(e, from->delta_time, from->data.ptr, from->event_len);
+			}
+		} else {
+			//inline bytes are copied with the event, and borrowed and pooled bytes are shared
+			(*e) = (*from);
+			if(from->storage == EVENT_STORAGE_POOLED){
+				payload_pool_retain(from->data.ptr);
+			}
+		}
+		copy->events[i] = e;
+	}
+	copy->event_count = count;
+	return copy;
+}
+
+struct MidiTrackChunk* midi_chunk_track_writable(struct MidiChunk* chunk){
+	struct MidiTrackChunk* track = midi_chunk_track(chunk);
+	if(!track || __atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1){
+		return track;
+	}
+	struct MidiTrackChunk* copy = copy_track(track);
+	chunk->chunk = copy;
+	//the other Midis may have let go of it in the meantime, leaving this one to free it
+	if(!__atomic_sub_fetch(&track->refs, 1, __ATOMIC_ACQ_REL)){
+		free_midi_track(track);
+		free(track);
+	}
+	return copy;
+}
+
+struct MidiTrackChunk* midi_track_writable(struct Midi* midi, uint32_t index){
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		if(midi->chunks[i]->type_e == CHUNK_TRACK && !index--){
+			return midi_chunk_track_writable(midi->chunks[i]);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Parses a whole MIDI file held in memory. The track chunks are found first, then decoded on `threads` threads.
+ * If `lazy` is set they are left to be decoded as they are accessed instead, borrowing from `data`.
+ * Events which are copied share their bytes through `pool` if it is set
+ */
+static struct Midi* parse_midi_buffer(const uint8_t* data, size_t size, int borrow, unsigned threads, int lazy, struct MidiPayloadPool* pool){
+	if(size < TYPE_LEN + 4 + HEADER_LEN || memcmp(data, "MThd", TYPE_LEN) || load_uint32_t(data + TYPE_LEN) != HEADER_LEN){
+		return NULL;
+	}
+	struct Midi* midi = malloc(sizeof(struct Midi));
+	new_midi(midi);
+	midi->pool = pool;
+
+	const uint8_t* header = data + TYPE_LEN + 4;
+	uint16_t tracks = load_uint16_t(header + 2);
+	midi_reserve_chunks(midi, tracks + 1);
+	midi_add_header(midi, load_uint16_t(header), tracks, load_uint16_t(header + 4));
+
+	//the tracks are added in file order up front, so decoding them in any order keeps that order
+	struct TrackJobs jobs;
+	jobs.jobs = malloc(sizeof(struct TrackJob) * tracks);
+	jobs.count = 0;
+	jobs.next = 0;
+	jobs.borrow = borrow;
+
+	size_t pos = TYPE_LEN + 4 + HEADER_LEN;
+	int valid = 1;
+	for(size_t i = 0; i < tracks;){
+		if(size - pos < TYPE_LEN + 4){
+			valid = 0;
+			break;
+		}
+		int is_track = !memcmp(data + pos, "MTrk", TYPE_LEN);
+		uint32_t size_track = load_uint32_t(data + pos + TYPE_LEN);
+		pos += TYPE_LEN + 4;
+		if(size_track > size - pos){
+			valid = 0;
+			break;
+		}
+		//unknown chunks are skipped, as the streaming reader and the seek index do
+		if(!is_track){
+			pos += size_track;
+			continue;
+		}
+		i++;
+		struct MidiTrackChunk* track = midi_add_track(midi);
+		if(lazy){
+			struct MidiChunk* chunk = midi->chunks[midi->chunk_count - 1];
+			chunk->pending = data + pos;
+			chunk->pending_len = size_track;
+			pos += size_track;
+			continue;
+		}
+		struct TrackJob* job = &jobs.jobs[jobs.count++];
+		job->track = track;
+		job->data = data + pos;
+		job->len = size_track;
+		job->failed = 0;
+		pos += size_track;
+	}
+
+	if(valid){
+		if(threads > jobs.count){
+			threads = jobs.count;
+		}
+		if(threads > 1){
+			//hand out the largest tracks first so a big track started last does not hold everything up
+			qsort(jobs.jobs, jobs.count, sizeof(struct TrackJob), compare_track_jobs);
+			pthread_t* workers = malloc(sizeof(pthread_t) * (threads - 1));
+			size_t started = 0;
+			for(; started < threads - 1; ++started){
+				if(pthread_create(&workers[started], NULL, parse_track_worker, &jobs)){
+					break;
+				}
+			}
+			//this thread takes part too, so the work still gets done if no thread could be started
+			parse_track_worker(&jobs);
+			for(size_t i = 0; i < started; ++i){
+				pthread_join(workers[i], NULL);
+			}
+			free(workers);
+		} else {
+			parse_track_worker(&jobs);
+		}
+		for(size_t i = 0; i < jobs.count; ++i){
+			if(jobs.jobs[i].failed){
+				valid = 0;
+			}
+		}
+	}
+	free(jobs.jobs);
+
+	if(!valid){
+		//the file ended early or a track was malformed
+		free_midi(midi);
+		free(midi);
+		return NULL;
+	}
+	return midi;
+}
+
+struct Midi* read_midi_buffer(const uint8_t* data, size_t size){
+	return parse_midi_buffer(data, size, 1, 1, 0, NULL);
+}
+
+struct Midi* read_midi_buffer_lazy(const uint8_t* data, size_t size){
+	return parse_midi_buffer(data, size, 1, 1, 1, NULL);
+}
+
+uint8_t* read_remaining(FILE* f, size_t* size){
+	(*size) = 0;
+	size_t capacity = READ_BLOCK_LEN;
+	uint8_t* data = malloc(capacity);
+	size_t read;
+	while((read = fread(data + (*size), sizeof(uint8_t), capacity - (*size), f))){
+		(*size) += read;
+		if((*size) == capacity){
+			capacity *= 2;
+			data = realloc(data, capacity);
+		}
+	}
+	return data;
+}
+
+struct Midi* read_midi_parallel(FILE* f, unsigned threads){
+	if(!threads){
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (unsigned) cores : 1;
+	}
+	size_t size;
+	uint8_t* data = read_remaining(f, &size);
+	struct Midi* midi = parse_midi_buffer(data, size, 0, threads, 0, NULL);
+	free(data);
+	return midi;
+}
+
+struct Midi* read_midi_pooled(FILE* f, struct MidiPayloadPool* pool){
+	size_t size;
+	uint8_t* data = read_remaining(f, &size);
+	struct Midi* midi = parse_midi_buffer(data, size, 0, 1, 0, pool);
+	free(data);
+	return midi;
+}
+
+struct Midi* read_midi_arena(FILE* f){
+	uint8_t chunk_head[TYPE_LEN + 4 + HEADER_LEN];
+	if(fread(chunk_head, sizeof(uint8_t), sizeof(chunk_head), f) != sizeof(chunk_head) || 
+			memcmp(chunk_head, "MThd", TYPE_LEN) || load_uint32_t(chunk_head + TYPE_LEN) != HEADER_LEN){
+		return NULL;
+	}
+	struct Midi* midi = malloc(sizeof(struct Midi));
+	new_midi_arena(midi, 0);
+
+	const uint8_t* header = chunk_head + TYPE_LEN + 4;
+	uint16_t tracks = load_uint16_t(header + 2);
+	midi_reserve_chunks(midi, tracks + 1);
+	midi_add_header(midi, load_uint16_t(header), tracks, load_uint16_t(header + 4));
+
+	int valid = 1;
+	for(size_t i = 0; i < tracks;){
+		if(fread(chunk_head, sizeof(uint8_t), TYPE_LEN + 4, f) != TYPE_LEN + 4){
+			valid = 0;
+			break;
+		}
+		uint32_t size_track = load_uint32_t(chunk_head + TYPE_LEN);
+		if(memcmp(chunk_head, "MTrk", TYPE_LEN)){
+			if(skip_chunk(f, size_track)){
+				valid = 0;
+				break;
+			}
+			continue;
+		}
+		i++;
+		struct MidiTrackChunk* track = midi_add_track(midi);
+
+		//the events borrow their bytes straight from this copy of the track
+		uint8_t* data = arena_alloc(midi->arena, size_track);
+		if(fread(data, sizeof(uint8_t), size_track, f) != size_track || parse_track_block(track, data, size_track, 1)){
+			valid = 0;
+			break;
+		}
+	}
+	if(!valid){
+		free_midi(midi);
+		free(midi);
+		return NULL;
+	}
+	return midi;
+}
+
+static struct MidiMap* map_midi(const char* path, int lazy){
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		return NULL;
+	}
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size <= 0){
+		close(fd);
+		return NULL;
+	}
+	size_t size = (size_t) st.st_size;
+	void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	//the mapping stays valid after the descriptor is closed
+	close(fd);
+	if(data == MAP_FAILED){
+		return NULL;
+	}
+
+	struct Midi* midi = parse_midi_buffer(data, size, 1, 1, lazy, NULL);
+	if(!midi){
+		munmap(data, size);
+		return NULL;
+	}
+
+	struct MidiMap* map = malloc(sizeof(struct MidiMap));
+	map->data = data;
+	map->size = size;
+	map->midi = midi;
+	return map;
+}
+
+struct MidiMap* open_midi_mmap(const char* path){
+	return map_midi(path, 0);
+}
+
+struct MidiMap* open_midi_mmap_lazy(const char* path){
+	return map_midi(path, 1);
+}
+
+void close_midi_mmap(struct MidiMap* map){
+	free_midi(map->midi);
+	free(map->midi);
+	map->midi = NULL;
+	munmap((void*) map->data, map->size);
+	map->data = NULL;
+	free(map);
+}
@@ -4,10 +4,29 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #define TYPE_LEN 4
 #define HEADER_LEN 6
 #define MAX_EVENT_LEN 50
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN 16
+#define EVENT_INLINE_LEN 8
+#define VARLEN_MAX_LEN 4
+#define VARLEN_MAX 0x0FFFFFFF
+#define READ_BLOCK_LEN 65536
+#define POOL_BUCKETS 64
+
+/*
+ * Flags for `write_midi_flags` which trade exact reproduction of the events for a smaller file
+ *
+ * WRITE_RUNNING_STATUS leaves out the status byte of voice events which repeat the previous status.
+ * WRITE_NOTE_OFF_AS_NOTE_ON writes note offs as note ons with a velocity of 0 (dropping the release velocity), 
+ * so they can share running status with the note ons around them.
+ */
+#define WRITE_RUNNING_STATUS 0x01
+#define WRITE_NOTE_OFF_AS_NOTE_ON 0x02
+#define WRITE_COMPACT (WRITE_RUNNING_STATUS | WRITE_NOTE_OFF_AS_NOTE_ON)
 
 /*
  * Represents the type of chunk internally.
@@ -22,10 +41,120 @@ enum ChunkType {
  */
 uint32_t varlen_to_int(const uint8_t* var, size_t* size);
 
+/*
+ * Converts a variable-length quantity to an integer without reading past `avail` bytes
+ *
+ * Returns 0 on success and -1 if the quantity is not terminated within `avail` (or VARLEN_MAX_LEN) bytes, so a
+ * quantity above VARLEN_MAX is an error
+ */
+int varlen_to_int_checked(const uint8_t* var, size_t avail, uint32_t* val, size_t* size);
+
 /*
  * Converts an integer to a variable-length quantity
+ *
+ * The returned buffer must be freed by the caller. `varlen_encode` avoids the allocation
  */
 uint8_t* int_to_varlen(uint32_t val, size_t* size);
+/*
+ * Writes `val` as a variable-length quantity into `var`, which must have room for VARLEN_MAX_LEN bytes
+ *
+ * `val` must be at most VARLEN_MAX, the largest quantity other MIDI readers accept. Larger values are written as
+ * VARLEN_MAX. Returns the number of bytes written
+ */
+size_t varlen_encode(uint32_t val, uint8_t* var);
+/*
+ * The number of bytes `val` takes up as a variable-length quantity, as written by `varlen_encode`
+ */
+size_t varlen_size(uint32_t val);
+
+/*
+ * Decodes the delta times of the events in the body of a track chunk in a single pass. Running status is handled.
+ *
+ * Up to `max` delta times are stored in `delta_times`, which may be NULL to only count the events.
+ * Decoding stops at the first malformed event. Returns the number of events decoded
+ */
+size_t decode_delta_times(const uint8_t* data, size_t len, uint32_t* delta_times, size_t max);
+
+/*
+ * A bump allocator which hands out memory from a list of large blocks.
+ *
+ * Nothing allocated from an arena is freed individually, everything is released at once by `free_arena`.
+ */
+struct MidiArenaBlock;
+struct MidiArena {
+	struct MidiArenaBlock* blocks;
+	size_t block_size;
+};
+
+/*
+ * Construct an empty arena. Blocks of `block_size` bytes are allocated as they are needed
+ *
+ * Requests larger than `block_size` get a block of their own.
+ */
+void new_arena(struct MidiArena* arena, size_t block_size);
+/*
+ * Free every block in the arena, and with them everything that was allocated from it.
+ *
+ * This does not free the arena itself
+ */
+void free_arena(struct MidiArena* arena);
+/*
+ * Allocate `size` bytes from the arena, aligned to ARENA_ALIGN
+ */
+void* arena_alloc(struct MidiArena* arena, size_t size);
+
+/*
+ * What a `MidiPayloadPool` holds, and what it would take up without sharing
+ */
+struct MidiPoolStats {
+	// distinct payloads held, and their total size
+	size_t payloads;
+	size_t payload_bytes;
+	// events referring to them, and the total size of their payloads if each had its own copy
+	size_t references;
+	size_t referenced_bytes;
+};
+
+/*
+ * A hash-consed store of event payloads, where identical payloads are kept once and reference counted.
+ *
+ * Events longer than EVENT_INLINE_LEN (e.g. sysex dumps and meta text) share their bytes through the pool when they are
+ * added to a track of a `Midi` whose `pool` is set. A pool may be shared by any number of `Midi`s on any number of
+ * threads, and must outlive the events using it.
+ */
+struct MidiPayload;
+struct MidiPayloadPool {
+	struct MidiPayload** buckets;
+	size_t bucket_count;
+
+	pthread_mutex_t lock;
+	struct MidiPoolStats stats;
+};
+
+/*
+ * Construct an empty pool
+ */
+void new_payload_pool(struct MidiPayloadPool* pool);
+/*
+ * Free every payload in the pool. The events using it should be freed first.
+ *
+ * This does not free the pool itself
+ */
+void free_payload_pool(struct MidiPayloadPool* pool);
+/*
+ * Returns the pool's copy of `len` bytes of `data`, adding it if it is not already held, and takes a reference to it.
+ *
+ * The copy must not be changed, and stays valid until the reference is given back with `payload_pool_release`
+ */
+const uint8_t* payload_pool_intern(struct MidiPayloadPool* pool, const uint8_t* data, size_t len);
+/*
+ * Gives back a reference taken by `payload_pool_intern`, freeing the payload once it has no references left
+ */
+void payload_pool_release(const uint8_t* payload);
+/*
+ * Copies the pool's statistics into `stats`
+ */
+void payload_pool_stats(struct MidiPayloadPool* pool, struct MidiPoolStats* stats);
 
 /*
  * Represents a chunk of a MIDI file. 
@@ -38,6 +167,12 @@ struct MidiChunk {
 	enum ChunkType type_e;
 
 	void* chunk;
+
+	// the undecoded events of a lazily read track, until it is first accessed with `midi_chunk_track`
+	const uint8_t* pending;
+	uint32_t pending_len;
+	// set once a lazily read track has failed to decode
+	int malformed;
 };
 
 /*
@@ -53,15 +188,31 @@ void new_midichunk(struct MidiChunk* chunk, enum ChunkType type);
  * This should never be used directly
  */
 void free_midichunk(struct MidiChunk* chunk);
+/*
+ * Returns the track held by a chunk, decoding its events first if the `Midi` was read lazily (see `read_midi_buffer_lazy`).
+ *
+ * This should be used instead of casting `chunk->chunk`. The decoded events are kept, so only the first access decodes.
+ * Decoding changes the chunk, so the first access to a lazily read track must not race with any other.
+ * Returns NULL for a header chunk, or for a lazily read track which turns out to be malformed. That chunk keeps an
+ * empty track, which is what the rest of the library (e.g. `write_midi`) treats it as.
+ */
+struct MidiTrackChunk* midi_chunk_track(struct MidiChunk* chunk);
 
 /*
  * The top level container of a MIDI file. This should be allocated and free'd by the caller
  */
 struct Midi {
 	uint32_t chunk_count;
+	uint32_t chunk_capacity;
 	struct MidiChunk** chunks;
 
 	struct MidiHeaderChunk* header;
+
+	// when set, every chunk, track, event and event buffer is allocated from here
+	struct MidiArena* arena;
+	// when set, long events added to the tracks share their bytes through this pool. It is not freed with the Midi
+	// and is not used for an arena backed Midi
+	struct MidiPayloadPool* pool;
 };
 
 /*
@@ -70,6 +221,13 @@ struct Midi {
  * This is the main container for the data
  */
 void new_midi(struct Midi* midi);
+/*
+ * Construct a MIDI whose whole object graph is allocated from an arena.
+ *
+ * `free_midi` then releases everything at once instead of walking every event.
+ * `block_size` of 0 uses ARENA_BLOCK_SIZE
+ */
+void new_midi_arena(struct Midi* midi, size_t block_size);
 
 /*
  * Free all of the children of this Midi file. 
@@ -84,6 +242,18 @@ void free_midi(struct Midi* midi);
  * This should not be called directly
  */
 struct MidiChunk* midi_add_chunk(struct Midi* midi);
+/*
+ * Makes sure the Midi can hold `capacity` chunks without growing.
+ *
+ * Chunks are otherwise made room for by doubling the capacity as they are added
+ */
+void midi_reserve_chunks(struct Midi* midi, uint32_t capacity);
+/*
+ * Releases any spare capacity held by the Midi and all of its tracks.
+ *
+ * This does nothing for an arena backed Midi
+ */
+void midi_shrink_to_fit(struct Midi* midi);
 /*
  * Allocates and creates a new header chunk for the Midi. 
  *
@@ -96,6 +266,37 @@ struct MidiHeaderChunk* midi_add_header(struct Midi* midi, uint16_t format, uint
  * This will be freed with its parent Midi
  */
 struct MidiTrackChunk* midi_add_track(struct Midi* midi);
+/*
+ * Returns the `index`th track of the Midi (not counting the header) through `midi_chunk_track`.
+ *
+ * Returns NULL if there is no such track or it is malformed
+ */
+struct MidiTrackChunk* midi_track(struct Midi* midi, uint32_t index);
+
+/*
+ * Makes a copy-on-write clone of the Midi, e.g. to derive several variants from one parsed file.
+ *
+ * The clone shares every track with `midi` by reference count. A track is only copied when it is first fetched with
+ * `midi_track_writable` or `midi_chunk_track_writable`, and shared tracks must not be changed any other way.
+ * The copy shares the bytes of long events through the Midi's payload pool if it has one, and keeps borrowing
+ * from the same memory if they were borrowed. The clone is allocated, and is freed with `free_midi` and `free` in any
+ * order with `midi`. Borrowed bytes are not copied though, so the buffer given to `read_midi_buffer` or the mapping
+ * of `open_midi_mmap` must outlive every clone, e.g. `close_midi_mmap` is only called once the clones are freed.
+ * A lazily read Midi has all of its tracks decoded first.
+ * The ticks of every track are cached (see `track_ticks`) before it is shared, and a shared track's serialized bytes
+ * are only used if they were already kept (see `track_serialized`), so nothing a shared track caches changes and
+ * the clones can be read, written or retimed on several threads at once.
+ * Returns NULL for an arena backed Midi, whose tracks cannot outlive it.
+ */
+struct Midi* midi_clone(struct Midi* midi);
+/*
+ * Returns the track held by a chunk like `midi_chunk_track`, first copying it if it is shared with a clone
+ */
+struct MidiTrackChunk* midi_chunk_track_writable(struct MidiChunk* chunk);
+/*
+ * Returns the `index`th track of the Midi like `midi_track`, first copying it if it is shared with a clone
+ */
+struct MidiTrackChunk* midi_track_writable(struct Midi* midi, uint32_t index);
 
 /*
  * Represents the header chunk of a Midi file
@@ -121,26 +322,73 @@ void new_midi_header(struct MidiHeaderChunk* header, uint32_t length, uint16_t f
  */
 void free_midi_header(struct MidiHeaderChunk* header);
 
+/*
+ * Describes where the bytes of a `MidiEvent` are stored.
+ *
+ * Inline events of up to EVENT_INLINE_LEN bytes are stored in the event itself, 
+ * owned events are allocated and freed with the event, and borrowed events point into memory
+ * which outlives the event (e.g. a mapped file) and are never freed by it.
+ */
+enum MidiEventStorage {
+	EVENT_STORAGE_OWNED,
+	EVENT_STORAGE_BORROWED,
+	EVENT_STORAGE_INLINE,
+	EVENT_STORAGE_POOLED
+};
+
 /*
  * This represents an event within a track. 
  *
  * This is usually created with a helper method.
+ * The bytes of the event should be accessed with `midi_event_data` since they may be stored in `data` directly
  */
 struct MidiEvent {
 	uint32_t delta_time;
+	enum MidiEventStorage storage;
 
 	size_t event_len;
-	uint8_t* event;
+	union {
+		uint8_t* ptr;
+		uint8_t bytes[EVENT_INLINE_LEN];
+	} data;
 };
 
 /*
  * This populates an event with the given details. 
  *
- * A copy of ev is made, so it can be deallocated at any time
+ * A copy of ev is made, so it can be deallocated at any time. 
+ * Events of up to EVENT_INLINE_LEN bytes are copied into the event itself rather than allocated
  *
  * This is usually called for you
  */
 void new_midi_event(struct MidiEvent* event, uint32_t delta_time, const uint8_t* ev, size_t event_length);
+/*
+ * Returns the bytes of the event, wherever they are stored.
+ *
+ * They are read-only, as borrowed bytes may be a read-only mapping and pooled bytes are shared with other events.
+ * Use `midi_event_data_mutable` to change them
+ */
+const uint8_t* midi_event_data(const struct MidiEvent* event);
+/*
+ * Returns the bytes of the event for changing in place.
+ *
+ * Borrowed and pooled bytes are first copied into bytes of the event's own, so the change only affects this event.
+ * An event of a track shared with a clone should be fetched through `midi_track_writable` first
+ */
+uint8_t* midi_event_data_mutable(struct MidiEvent* event);
+/*
+ * This populates an event which points at `ev` instead of copying it.
+ *
+ * `ev` must stay valid for as long as the event is used. It is never freed by the event.
+ */
+void new_midi_event_borrowed(struct MidiEvent* event, uint32_t delta_time, const uint8_t* ev, size_t event_length);
+/*
+ * This populates an event whose bytes are shared through `pool` (see `MidiPayloadPool`).
+ *
+ * `midi_event_data_mutable` gives the event its own copy before the bytes can be changed, since other events may be using them.
+ * Events of up to EVENT_INLINE_LEN bytes are still stored in the event itself
+ */
+void new_midi_event_pooled(struct MidiEvent* event, struct MidiPayloadPool* pool, uint32_t delta_time, const uint8_t* ev, size_t event_length);
 /*
  * This frees the `MidiEvent`
  *
@@ -152,9 +400,17 @@ void free_midi_event(struct MidiEvent* event);
  * Used to pull a `MidiEvent` from a buffer which may contain multiple `MidiEvent`s.
  *
  * It will allocate a new MidiEvent, and determine how much data was used from the buffer.
- * This is called by `read_midi`
+ * This does not handle running status, see `parse_midi_event_running`. It returns NULL for an event without a status byte.
  */
 struct MidiEvent* parse_midi_event(const uint8_t* event, size_t* size_read);
+/*
+ * Like `parse_midi_event`, but also handles events which use running status (i.e. leave out their status byte).
+ *
+ * `running_status` holds the status of the last voice event in the track and should start at 0 for each track.
+ * Events which use running status are stored with their status byte filled in.
+ * Returns NULL if the event uses running status when there is none. This is called by `read_midi`
+ */
+struct MidiEvent* parse_midi_event_running(const uint8_t* event, size_t* size_read, uint8_t* running_status);
 /*
  * Used by parse_midi_event. 
  *
@@ -163,6 +419,29 @@ struct MidiEvent* parse_midi_event(const uint8_t* event, size_t* size_read);
 size_t parse_midi_voice_event(const uint8_t* event_code);
 size_t parse_midi_sysex_event(const uint8_t* event_code);
 size_t parse_midi_meta_event(const uint8_t* event_code);
+/*
+ * Splits the delta time/event pair at the start of `event` without reading past `avail` bytes.
+ *
+ * If `running_status` is not NULL it is tracked as in `parse_midi_event_running`. An event using running status
+ * does not start with a status byte, and its `event_size` only covers its data bytes. `midi_event_with_status` fills it in.
+ * Nothing is allocated. Returns 0 on success and -1 if the pair is malformed or runs past `avail`
+ */
+int parse_midi_event_bounds(const uint8_t* event, size_t avail, uint8_t* running_status, uint32_t* delta_time, size_t* delta_time_size, size_t* event_size);
+/*
+ * Gives the complete bytes of an event which may be using running status.
+ *
+ * If `event` leaves out its status byte, `running_status` and the event are copied into `scratch` (which must hold 3 bytes)
+ * and `event_len` is updated. Otherwise `event` is returned as is
+ */
+const uint8_t* midi_event_with_status(const uint8_t* event, size_t* event_len, uint8_t running_status, uint8_t* scratch);
+/*
+ * Works out the bytes to write for an event under the given WRITE_ flags.
+ *
+ * `running_status` holds the last status written in the track and should start at 0 for each track. 
+ * Rewritten voice events are placed in `scratch` (which must hold 3 bytes). 
+ * Returns the bytes to write and stores how many in `out_len`
+ */
+const uint8_t* midi_event_encoding(const uint8_t* event, size_t event_len, unsigned flags, uint8_t* running_status, uint8_t* scratch, size_t* out_len);
 
 /*
  * This represents a track containing a series of `MidiEvent`s. 
@@ -171,8 +450,34 @@ size_t parse_midi_meta_event(const uint8_t* event_code);
  */
 struct MidiTrackChunk {
 	size_t event_count;
+	size_t event_capacity;
 
 	struct MidiEvent** events;
+
+	// the first `block_count` events live in this single allocation rather than
+	// being allocated one by one (see `open_midi_mmap`)
+	struct MidiEvent* event_block;
+	size_t block_count;
+
+	// set when the track belongs to an arena backed `Midi`
+	struct MidiArena* arena;
+	// set when the track belongs to a `Midi` with a payload pool
+	struct MidiPayloadPool* pool;
+
+	// the absolute tick of each event, see `track_ticks`. Only the first `ticks_valid` entries are up to date
+	uint64_t* ticks;
+	size_t ticks_valid;
+	size_t ticks_capacity;
+
+	// the length of the events as last written with `serialized_flags`, and the bytes themselves once they are kept
+	// (see `track_serialized`). Out of date while `dirty` is set
+	uint8_t* serialized;
+	size_t serialized_len;
+	unsigned serialized_flags;
+	int dirty;
+
+	// how many Midis share the track, see `midi_clone`. Only 1 allows changes
+	size_t refs;
 };
 
 /*
@@ -188,10 +493,25 @@ void new_midi_track(struct MidiTrackChunk* track);
  */
 void free_midi_track(struct MidiTrackChunk* track);
 
+/*
+ * Makes sure the track can hold `capacity` events without growing.
+ *
+ * Events are otherwise made room for by doubling the capacity as they are added, 
+ * so reserving is only needed to avoid the copies when the final size is known up front
+ */
+void track_reserve(struct MidiTrackChunk* track, size_t capacity);
+/*
+ * Releases any spare capacity held by the track. 
+ *
+ * This does nothing for an arena backed track
+ */
+void track_shrink_to_fit(struct MidiTrackChunk* track);
+
 /*
  * This creates a new empty event within the given track. This event can then be populated with details. 
  *
- * It will be freed automatically with the track.
+ * It will be freed automatically with the track, along with any bytes it is given by `new_midi_event`.
+ * In an arena backed track those bytes are allocated on their own, while `track_add_event_full` puts them in the arena.
  */
 struct MidiEvent* track_add_event(struct MidiTrackChunk* track);
 /*
@@ -203,13 +523,53 @@ struct MidiEvent* track_add_event_full(struct MidiTrackChunk* track, uint32_t de
 /*
  * This adds an existing `MidiEvent` to the given track.
  *
- * It will be freed automatically with the track.
+ * It will be freed automatically with the track. 
+ * If the track is arena backed the event is never freed, so it should come from the same arena.
  */
 void track_add_event_existing(struct MidiTrackChunk* track, struct MidiEvent* event);
+/*
+ * Returns the absolute tick of every event in the track, i.e. the running sum of the delta times.
+ *
+ * The column is cached in the track, and only the events added or invalidated since the last call are summed again.
+ * Adding events with the track_add_ functions keeps the cache valid. After changing the `delta_time` of an event
+ * or the `events` array directly, call `track_invalidate_ticks`.
+ * The array is owned by the track and holds `event_count` entries. It is valid until the next change to the track
+ */
+const uint64_t* track_ticks(struct MidiTrackChunk* track);
+/*
+ * Marks the cached ticks of event `from` onwards as out of date. This also marks the track dirty
+ */
+void track_invalidate_ticks(struct MidiTrackChunk* track, size_t from);
+/*
+ * Returns the index of the first event at or after `tick`, or `event_count` if every event is before it.
+ *
+ * This is a binary search over `track_ticks`, so it is O(log n) once the ticks are cached
+ */
+size_t track_find_tick(struct MidiTrackChunk* track, uint64_t tick);
 /*
  * This calculates the total size of the track. It is used within `write_midi`
  */
 size_t track_length(struct MidiTrackChunk* track);
+/*
+ * This calculates the total size of the track when written with the given WRITE_ flags
+ */
+size_t track_length_flags(struct MidiTrackChunk* track, unsigned flags);
+/*
+ * Returns the bytes of the track's events as written with the given WRITE_ flags, and stores how many in `len`.
+ *
+ * The bytes are kept in the track, so writing it again unchanged is a single copy instead of encoding every event.
+ * The writers encode a changed track straight into their output, and only keep its bytes from the second time it is
+ * written unchanged with the same flags, so a Midi written once does not hold a second copy of every track.
+ * Adding events with the track_add_ functions marks the track dirty, and so does `track_invalidate_ticks`. After changing
+ * an event in place, call `track_mark_dirty`. The bytes are owned by the track and are valid until it next changes.
+ * Since this updates the track, writing the same `Midi` from several threads at once is not safe.
+ * Returns NULL if the track is shared with a clone (see `midi_clone`) and its bytes were not kept before it was shared
+ */
+const uint8_t* track_serialized(struct MidiTrackChunk* track, unsigned flags, size_t* len);
+/*
+ * Marks the bytes kept by `track_serialized` as out of date
+ */
+void track_mark_dirty(struct MidiTrackChunk* track);
 
 /*
  * Used to write uint16_t and uin32_t in big-endian format. 
@@ -221,17 +581,120 @@ void write_uint32_t(uint32_t data, FILE* f);
  * Writes the Midi to the given opened `FILE`. 
  */
 void write_midi(struct Midi* m, FILE* f);
+/*
+ * Writes the Midi to the given opened `FILE`, compacted according to the WRITE_ flags
+ */
+void write_midi_flags(struct Midi* m, FILE* f, unsigned flags);
+/*
+ * This calculates the exact size of the Midi once written with the given WRITE_ flags
+ */
+size_t midi_length_flags(struct Midi* m, unsigned flags);
+/*
+ * Writes the Midi into memory, compacted according to the WRITE_ flags.
+ *
+ * If `buffer` is NULL a buffer of exactly the right size is allocated, which the caller must `free`.
+ * Otherwise `buffer` holds `*size` bytes, and NULL is returned if that is not enough.
+ * Either way `*size` is set to the size of the written Midi.
+ */
+uint8_t* write_midi_to_buffer(struct Midi* m, unsigned flags, uint8_t* buffer, size_t* size);
+/*
+ * Writes the Midi to a file descriptor (e.g. a socket) with `writev`, compacted according to the WRITE_ flags.
+ *
+ * Headers, delta times and short events are gathered into a staging buffer, while long events such as sysex dumps,
+ * and the bytes a track keeps (see `track_serialized`), are written straight from where they are without being copied.
+ * Returns 0 on success and -1 if a write failed
+ */
+int write_midi_fd(struct Midi* m, int fd, unsigned flags);
 
 /*
  * Used to read uint16_t and uint32_t from big-endian format
  */
 uint16_t read_uint16_t(FILE* f);
 uint32_t read_uint32_t(FILE* f);
+/*
+ * Used to read uint16_t and uint32_t from a big-endian buffer
+ */
+uint16_t load_uint16_t(const uint8_t* data);
+uint32_t load_uint32_t(const uint8_t* data);
+/*
+ * Reads everything left in `f` into a buffer grown from READ_BLOCK_LEN bytes, which the caller must `free`.
+ * `size` is set to how many bytes were read
+ */
+uint8_t* read_remaining(FILE* f, size_t* size);
 
 /*
  * Reads a `FILE` in from Midi format and returns a `Midi` containing it
  */
 struct Midi* read_midi(FILE* f);
+/*
+ * Reads a `FILE` in from Midi format into an arena backed `Midi` (see `new_midi_arena`)
+ *
+ * Each track is read into the arena in one piece and its events point into it, so nothing is copied twice.
+ * Returns NULL if the file is not a valid MIDI file.
+ */
+struct Midi* read_midi_arena(FILE* f);
+/*
+ * Reads a `FILE` in from Midi format, sharing the bytes of long events (sysex dumps, meta text) through `pool`.
+ *
+ * Identical payloads within the file, and across every file read into the same pool, are only stored once.
+ * The returned `Midi` keeps `pool` set. Returns NULL if the file is not a valid MIDI file.
+ */
+struct Midi* read_midi_pooled(FILE* f, struct MidiPayloadPool* pool);
+
+/*
+ * Reads a `FILE` in from Midi format, decoding its tracks concurrently on `threads` threads (0 uses one per core)
+ *
+ * The whole file is read in first so every track can be found from its chunk header, then the tracks are decoded
+ * independently. They keep the order they have in the file. Returns NULL if the file is not a valid MIDI file.
+ */
+struct Midi* read_midi_parallel(FILE* f, unsigned threads);
+
+/*
+ * Parses a MIDI file held in memory without copying any event data, like `open_midi_mmap`.
+ *
+ * The events point into `data`, which must outlive the returned `Midi`. Returns NULL if it is not a valid MIDI file.
+ */
+struct Midi* read_midi_buffer(const uint8_t* data, size_t size);
+/*
+ * Like `read_midi_buffer`, but only the header and the position of each track is read up front.
+ *
+ * A track's events are decoded the first time it is accessed with `midi_chunk_track` or `midi_track`, so opening a
+ * file to look at one track costs about the same however many tracks it has.
+ * Returns NULL if the chunks cannot be found, while a malformed track is only noticed once it is accessed.
+ */
+struct Midi* read_midi_buffer_lazy(const uint8_t* data, size_t size);
+
+/*
+ * A read-only memory mapping of a MIDI file along with the `Midi` parsed from it.
+ *
+ * Every `MidiEvent` in `midi` borrows its bytes from the mapping, so the `Midi` 
+ * is only valid until `close_midi_mmap` is called. The mapping cannot be written to, so change events through
+ * `midi_event_data_mutable`, which copies them out of it first.
+ */
+struct MidiMap {
+	const uint8_t* data;
+	size_t size;
+
+	struct Midi* midi;
+};
+
+/*
+ * Maps the file at `path` and parses it without copying any event data.
+ *
+ * Each track is parsed into a single block of `MidiEvent`s, so no per-event allocation is made.
+ * Returns NULL if the file cannot be mapped or is not a valid MIDI file.
+ */
+struct MidiMap* open_midi_mmap(const char* path);
+/*
+ * Maps the file at `path` and reads it lazily, see `read_midi_buffer_lazy`
+ */
+struct MidiMap* open_midi_mmap_lazy(const char* path);
+/*
+ * Frees the `Midi` and unmaps the file. 
+ *
+ * This also frees the `MidiMap` itself
+ */
+void close_midi_mmap(struct MidiMap* map);
 
 //www.personal.kent.edu/~sbirch/Music_Production/MP-II/MIDI/midi_file_format.htm
 
@@ -0,0 +1,246 @@
+//for pthreads, open and clock_gettime
+#define _POSIX_C_SOURCE 200809L
+
+#include "midi_batch.h"
+
+#include <string.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * The files a worker has left to process, as a range of indices into the batch's paths.
+ *
+ * The owner takes files from the front, thieves take the back half
+ */
+struct BatchDeque {
+	size_t begin;
+	size_t end;
+	pthread_mutex_t lock;
+};
+
+struct Batch;
+
+struct BatchWorker {
+	struct Batch* batch;
+	unsigned index;
+	pthread_t thread;
+
+	// reused for every file this worker reads
+	uint8_t* buffer;
+	size_t buffer_capacity;
+
+	size_t files;
+	size_t failed;
+	uint64_t bytes;
+};
+
+struct Batch {
+	const char* const* paths;
+	unsigned threads;
+	struct BatchDeque* deques;
+	struct BatchWorker* workers;
+
+	MidiBatchCallback callback;
+	void* user;
+};
+
+static int batch_pop(struct Batch* batch, unsigned w, size_t* item){
+	struct BatchDeque* deque = &batch->deques[w];
+	pthread_mutex_lock(&deque->lock);
+	int found = deque->begin < deque->end;
+	if(found){
+		(*item) = deque->begin++;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+/*
+ * Moves the back half of the fullest other deque into worker `w`'s (empty) deque.
+ *
+ * Returns 0 if every other deque is empty
+ */
+static int batch_steal(struct Batch* batch, unsigned w){
+	while(1){
+		unsigned victim = w;
+		size_t most = 0;
+		for(unsigned i = 0; i < batch->threads; ++i){
+			if(i == w){
+				continue;
+			}
+			struct BatchDeque* deque = &batch->deques[i];
+			pthread_mutex_lock(&deque->lock);
+			size_t remaining = deque->end - deque->begin;
+			pthread_mutex_unlock(&deque->lock);
+			if(remaining > most){
+				most = remaining;
+				victim = i;
+			}
+		}
+		if(victim == w){
+			return 0;
+		}
+
+		struct BatchDeque* deque = &batch->deques[victim];
+		pthread_mutex_lock(&deque->lock);
+		size_t remaining = deque->end - deque->begin;
+		size_t end = deque->end;
+		size_t mid = deque->begin + remaining / 2;
+		deque->end = mid;
+		pthread_mutex_unlock(&deque->lock);
+		if(end == mid){
+			//the victim finished its files in the meantime, look again
+			continue;
+		}
+
+		struct BatchDeque* own = &batch->deques[w];
+		pthread_mutex_lock(&own->lock);
+		own->begin = mid;
+		own->end = end;
+		pthread_mutex_unlock(&own->lock);
+		return 1;
+	}
+}
+
+/*
+ * Reads the whole file at `path` into the worker's buffer. Returns the size read, or -1 on failure
+ */
+static long batch_read(struct BatchWorker* worker, const char* path){
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st)){
+		close(fd);
+		return -1;
+	}
+	size_t size = (size_t) st.st_size;
+	if(size > worker->buffer_capacity){
+		free(worker->buffer);
+		worker->buffer = malloc(size);
+		worker->buffer_capacity = size;
+	}
+	size_t pos = 0;
+	while(pos < size){
+		ssize_t n = read(fd, worker->buffer + pos, size - pos);
+		if(n <= 0){
+			close(fd);
+			return -1;
+		}
+		pos += (size_t) n;
+	}
+	close(fd);
+	return (long) size;
+}
+
+static void batch_process(struct BatchWorker* worker, const char* path){
+	struct Batch* batch = worker->batch;
+	struct Midi* midi = NULL;
+	long size = batch_read(worker, path);
+	if(size >= 0){
+		midi = read_midi_buffer(worker->buffer, (size_t) size);
+		worker->bytes += (uint64_t) size;
+	}
+	if(!midi){
+		worker->failed++;
+	}
+	worker->files++;
+
+	batch->callback(path, midi, worker->index, batch->user);
+	if(midi){
+		free_midi(midi);
+		free(midi);
+	}
+}
+
+static void* batch_worker(void* arg){
+	struct BatchWorker* worker = (struct BatchWorker*) arg;
+	struct Batch* batch = worker->batch;
+	do {
+		size_t item;
+		while(batch_pop(batch, worker->index, &item)){
+			batch_process(worker, batch->paths[item]);
+		}
+	} while(batch_steal(batch, worker->index));
+	return NULL;
+}
+
+static double seconds_since(const struct timespec* start){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int midi_batch_run(const char* const* paths, size_t count, unsigned threads, MidiBatchCallback callback, void* user, struct MidiBatchStats* stats){
+	if(!threads){
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (unsigned) cores : 1;
+	}
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	struct Batch batch;
+	batch.paths = paths;
+	batch.threads = threads;
+	batch.callback = callback;
+	batch.user = user;
+	batch.deques = malloc(sizeof(struct BatchDeque) * threads);
+	batch.workers = malloc(sizeof(struct BatchWorker) * threads);
+	for(unsigned i = 0; i < threads; ++i){
+		//every worker starts with an equal share of the files
+		batch.deques[i].begin = count * i / threads;
+		batch.deques[i].end = count * (i + 1) / threads;
+		pthread_mutex_init(&batch.deques[i].lock, NULL);
+
+		struct BatchWorker* worker = &batch.workers[i];
+		worker->batch = &batch;
+		worker->index = i;
+		worker->buffer = NULL;
+		worker->buffer_capacity = 0;
+		worker->files = 0;
+		worker->failed = 0;
+		worker->bytes = 0;
+	}
+
+	//worker 0 runs on this thread
+	unsigned started = 1;
+	for(; started < threads; ++started){
+		if(pthread_create(&batch.workers[started].thread, NULL, batch_worker, &batch.workers[started])){
+			break;
+		}
+	}
+	batch_worker(&batch.workers[0]);
+
+	//every worker has to be done before any deque goes, since they steal from each other
+	for(unsigned i = 1; i < started; ++i){
+		pthread_join(batch.workers[i].thread, NULL);
+	}
+	struct MidiBatchStats totals;
+	memset(&totals, 0, sizeof(totals));
+	for(unsigned i = 0; i < threads; ++i){
+		struct BatchWorker* worker = &batch.workers[i];
+		totals.files += worker->files;
+		totals.failed += worker->failed;
+		totals.bytes += worker->bytes;
+		free(worker->buffer);
+		pthread_mutex_destroy(&batch.deques[i].lock);
+	}
+	free(batch.deques);
+	free(batch.workers);
+
+	totals.seconds = seconds_since(&start);
+	if(totals.seconds > 0){
+		totals.files_per_sec = totals.files / totals.seconds;
+		totals.bytes_per_sec = totals.bytes / totals.seconds;
+	}
+	if(stats){
+		(*stats) = totals;
+	}
+	return totals.failed > INT_MAX ? INT_MAX : (int) totals.failed;
+}
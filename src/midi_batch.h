@@ -0,0 +1,38 @@
+#ifndef MIDI_BATCH_H
+#define MIDI_BATCH_H
+
+#include "midi.h"
+
+/*
+ * Called once for every file in a batch.
+ *
+ * `midi` is NULL if the file could not be read or is not a valid MIDI file. It borrows from a buffer owned by the
+ * worker, so it is only valid until the callback returns and must not be freed.
+ * Callbacks run concurrently on `worker` (0 .. threads - 1), which can be used to index per-worker results.
+ */
+typedef void (*MidiBatchCallback)(const char* path, struct Midi* midi, unsigned worker, void* user);
+
+/*
+ * How a batch went. Rates are over the wall clock time of the whole batch
+ */
+struct MidiBatchStats {
+	size_t files;
+	size_t failed;
+	uint64_t bytes;
+
+	double seconds;
+	double files_per_sec;
+	double bytes_per_sec;
+};
+
+/*
+ * Reads and parses every file in `paths` on `threads` threads (0 uses one per core), calling `callback` for each.
+ *
+ * Each worker starts with an equal share of the files and steals half of the remaining share of the busiest worker
+ * once it runs out, so a few huge files among many small ones do not leave threads idle.
+ * Every worker reads files into its own buffer which is reused from file to file.
+ * `stats` may be NULL. Returns how many files could not be read or parsed (at most INT_MAX), so 0 if every one was
+ */
+int midi_batch_run(const char* const* paths, size_t count, unsigned threads, MidiBatchCallback callback, void* user, struct MidiBatchStats* stats);
+
+#endif /* MIDI_BATCH_H */
@@ -43,12 +43,9 @@ struct EventString* add_string(struct EventString* event, char* str, size_t s){
 }
 
 struct EventString* add_buffer(struct EventString* event, uint8_t* str, size_t s){
-	size_t varlen_size;
-	uint8_t* varlen = int_to_varlen(s, &varlen_size);
-	event = add_to_event(event, varlen, varlen_size);
+	uint8_t varlen[VARLEN_MAX_LEN];
+	event = add_to_event(event, varlen, varlen_encode(s, varlen));
 	event = add_to_event(event, str, s);
-	free(varlen);
-	varlen = NULL;
 	return event;
 }
 
@@ -0,0 +1,163 @@
+#include "midi_merge.h"
+#include "midi_constants.h"
+#include "midi_stream.h"
+
+#include <string.h>
+
+/*
+ * Whether track `a` comes before track `b` in the heap
+ */
+static int merge_before(const struct MidiMerge* merge, uint16_t a, uint16_t b){
+	if(merge->next_tick[a] != merge->next_tick[b]){
+		return merge->next_tick[a] < merge->next_tick[b];
+	}
+	return a < b;
+}
+
+static void merge_sift_up(struct MidiMerge* merge, uint16_t pos){
+	uint16_t track = merge->heap[pos];
+	while(pos){
+		uint16_t parent = (pos - 1) / 2;
+		if(!merge_before(merge, track, merge->heap[parent])){
+			break;
+		}
+		merge->heap[pos] = merge->heap[parent];
+		pos = parent;
+	}
+	merge->heap[pos] = track;
+}
+
+static void merge_sift_down(struct MidiMerge* merge, uint16_t pos){
+	uint16_t track = merge->heap[pos];
+	while(1){
+		size_t child = (size_t) pos * 2 + 1;
+		if(child >= merge->heap_len){
+			break;
+		}
+		if(child + 1 < merge->heap_len && merge_before(merge, merge->heap[child + 1], merge->heap[child])){
+			child++;
+		}
+		if(!merge_before(merge, merge->heap[child], track)){
+			break;
+		}
+		merge->heap[pos] = merge->heap[child];
+		pos = (uint16_t) child;
+	}
+	merge->heap[pos] = track;
+}
+
+void midi_merge_open(struct MidiMerge* merge, struct Midi* midi){
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		if(midi->chunks[i]->type_e == CHUNK_TRACK && count < UINT16_MAX){
+			count++;
+		}
+	}
+	merge->track_count = (uint16_t) count;
+	merge->tracks = malloc(sizeof(struct MidiTrackChunk*) * (count ? count : 1));
+	merge->next = malloc(sizeof(size_t) * (count ? count : 1));
+	merge->next_tick = malloc(sizeof(uint64_t) * (count ? count : 1));
+	merge->heap = malloc(sizeof(uint16_t) * (count ? count : 1));
+	merge->heap_len = 0;
+	merge->tick = 0;
+
+	uint16_t t = 0;
+	for(uint32_t i = 0; i < midi->chunk_count && t < count; ++i){
+		if(midi->chunks[i]->type_e != CHUNK_TRACK){
+			continue;
+		}
+		struct MidiTrackChunk* track = midi_chunk_track(midi->chunks[i]);
+		if(!track){
+			//a malformed lazily read track has no events, but still takes up its track number
+			track = (struct MidiTrackChunk*) midi->chunks[i]->chunk;
+		}
+		merge->tracks[t] = track;
+		merge->next[t] = 0;
+		if(track->event_count){
+			merge->next_tick[t] = track->events[0]->delta_time;
+			merge->heap[merge->heap_len] = t;
+			merge_sift_up(merge, merge->heap_len);
+			merge->heap_len++;
+		}
+		t++;
+	}
+}
+
+int midi_merge_next(struct MidiMerge* merge, struct MidiMergeEvent* event){
+	if(!merge->heap_len){
+		return 0;
+	}
+	uint16_t t = merge->heap[0];
+	struct MidiTrackChunk* track = merge->tracks[t];
+	size_t index = merge->next[t]++;
+
+	event->track = t;
+	event->index = index;
+	event->tick = merge->next_tick[t];
+	event->delta_time = event->tick - merge->tick;
+	event->event = track->events[index];
+	merge->tick = event->tick;
+
+	if(merge->next[t] < track->event_count){
+		//the track's next event replaces it at the top, then sinks to its place
+		merge->next_tick[t] += track->events[merge->next[t]]->delta_time;
+	} else {
+		merge->heap[0] = merge->heap[--merge->heap_len];
+	}
+	if(merge->heap_len){
+		merge_sift_down(merge, 0);
+	}
+	return 1;
+}
+
+void midi_merge_close(struct MidiMerge* merge){
+	free(merge->tracks);
+	merge->tracks = NULL;
+	free(merge->next);
+	merge->next = NULL;
+	free(merge->next_tick);
+	merge->next_tick = NULL;
+	free(merge->heap);
+	merge->heap = NULL;
+	merge->track_count = 0;
+	merge->heap_len = 0;
+}
+
+int midi_flatten_to_format0(struct Midi* midi, FILE* f, unsigned flags){
+	struct MidiHeaderChunk* header = midi->header;
+	if(!header){
+		return -1;
+	}
+
+	struct MidiWriter writer;
+	if(midi_writer_open(&writer, f, 0, 1, header->division)){
+		return -1;
+	}
+	writer.flags = flags;
+	midi_writer_begin_track(&writer);
+
+	struct MidiMerge merge;
+	midi_merge_open(&merge, midi);
+	struct MidiMergeEvent ev;
+	// the tick of the last event written, and of the latest end of track seen
+	uint64_t written = 0;
+	uint64_t end = 0;
+	while(midi_merge_next(&merge, &ev)){
+		struct MidiEvent* e = ev.event;
+		const uint8_t* data = midi_event_data(e);
+		if(e->event_len >= 2 && data[0] == 0xFF && data[1] == META_END_OF_TRACK){
+			if(ev.tick > end){
+				end = ev.tick;
+			}
+			continue;
+		}
+		midi_writer_event(&writer, (uint32_t) (ev.tick - written), data, e->event_len);
+		written = ev.tick;
+	}
+	midi_merge_close(&merge);
+
+	const uint8_t end_of_track[3] = {0xFF, META_END_OF_TRACK, 0x00};
+	midi_writer_event(&writer, (uint32_t) (end > written ? end - written : 0), end_of_track, sizeof(end_of_track));
+	midi_writer_end_track(&writer);
+	return midi_writer_close(&writer);
+}
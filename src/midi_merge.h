@@ -0,0 +1,71 @@
+#ifndef MIDI_MERGE_H
+#define MIDI_MERGE_H
+
+#include "midi.h"
+
+/*
+ * An iterator over the events of every track of a `Midi` in time order.
+ *
+ * The next event of each track is kept in a binary heap keyed on its absolute tick, so each event costs
+ * O(log T) for T tracks. Events at the same tick come out in track order, and in their order within a track.
+ * Nothing is copied, the events yielded are the ones in the tracks.
+ *
+ * The `Midi` must not be changed while it is being merged.
+ */
+struct MidiMerge {
+	struct MidiTrackChunk** tracks;
+	uint16_t track_count;
+
+	// the index and absolute tick of the next event of each track
+	size_t* next;
+	uint64_t* next_tick;
+
+	// tracks which still have events, ordered by (next_tick, track)
+	uint16_t* heap;
+	uint16_t heap_len;
+
+	uint64_t tick;
+};
+
+/*
+ * An event yielded by the merge
+ */
+struct MidiMergeEvent {
+	// the index of the track among the track chunks, and of the event within that track
+	uint16_t track;
+	size_t index;
+
+	// the absolute tick of the event, and the ticks since the previous event yielded
+	uint64_t tick;
+	uint64_t delta_time;
+
+	struct MidiEvent* event;
+};
+
+/*
+ * Starts merging the tracks of `midi`
+ */
+void midi_merge_open(struct MidiMerge* merge, struct Midi* midi);
+/*
+ * Yields the next event across all the tracks.
+ *
+ * Returns 1 when an event was yielded and 0 once every track has been exhausted
+ */
+int midi_merge_next(struct MidiMerge* merge, struct MidiMergeEvent* event);
+/*
+ * Frees the memory held by the merge.
+ *
+ * This does not free the merge itself
+ */
+void midi_merge_close(struct MidiMerge* merge);
+
+/*
+ * Writes every track of `midi` merged into the single track of a format 0 file to the given opened `FILE`.
+ *
+ * The end of track events of the tracks are dropped, and one end of track is written at the end of the latest track.
+ * Events are streamed out as they are merged, compacted according to the WRITE_ `flags`.
+ * Returns 0 on success and -1 if the `Midi` has no header or a write failed
+ */
+int midi_flatten_to_format0(struct Midi* midi, FILE* f, unsigned flags);
+
+#endif /* MIDI_MERGE_H */
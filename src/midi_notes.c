@@ -0,0 +1,150 @@
+#include "midi_notes.h"
+#include "midi_constants.h"
+#include "midi_merge.h"
+
+// marks a note which has not ended yet, and an empty stack
+#define NOTE_OPEN UINT64_MAX
+#define NO_NOTE SIZE_MAX
+
+static void notes_reserve(struct MidiNotes* notes, size_t capacity, size_t** below){
+	notes->start = realloc(notes->start, sizeof(uint64_t) * capacity);
+	notes->end = realloc(notes->end, sizeof(uint64_t) * capacity);
+	notes->pitch = realloc(notes->pitch, sizeof(uint8_t) * capacity);
+	notes->velocity = realloc(notes->velocity, sizeof(uint8_t) * capacity);
+	notes->channel = realloc(notes->channel, sizeof(uint8_t) * capacity);
+	notes->track = realloc(notes->track, sizeof(uint16_t) * capacity);
+	(*below) = realloc(*below, sizeof(size_t) * capacity);
+	notes->capacity = capacity;
+}
+
+/*
+ * Fills in max_end for the subtree of [lo, hi) and returns it
+ */
+static uint64_t notes_index(struct MidiNotes* notes, size_t lo, size_t hi){
+	if(lo >= hi){
+		return 0;
+	}
+	size_t mid = lo + (hi - lo) / 2;
+	uint64_t max_end = notes->end[mid];
+	uint64_t left = notes_index(notes, lo, mid);
+	uint64_t right = notes_index(notes, mid + 1, hi);
+	if(left > max_end){
+		max_end = left;
+	}
+	if(right > max_end){
+		max_end = right;
+	}
+	notes->max_end[mid] = max_end;
+	return max_end;
+}
+
+void new_midi_notes(struct MidiNotes* notes, struct Midi* midi){
+	notes->count = 0;
+	notes->capacity = 0;
+	notes->start = NULL;
+	notes->end = NULL;
+	notes->pitch = NULL;
+	notes->velocity = NULL;
+	notes->channel = NULL;
+	notes->track = NULL;
+	notes->max_end = NULL;
+
+	// the latest note still sounding for each channel and pitch, with each note linking to the one below it
+	size_t open[16 * 128];
+	for(size_t i = 0; i < 16 * 128; ++i){
+		open[i] = NO_NOTE;
+	}
+	size_t* below = NULL;
+
+	//the merge yields the events of every track in tick order, so the notes come out sorted by start
+	struct MidiMerge merge;
+	midi_merge_open(&merge, midi);
+	struct MidiMergeEvent ev;
+	uint64_t last_tick = 0;
+	while(midi_merge_next(&merge, &ev)){
+		last_tick = ev.tick;
+		const uint8_t* data = midi_event_data(ev.event);
+		uint8_t status = data[0] & 0xF0;
+		if(ev.event->event_len != 3 || (status != VOICE_NOTE_ON && status != VOICE_NOTE_OFF)){
+			continue;
+		}
+		size_t key = (size_t) (data[0] & 0x0F) * 128 + (data[1] & 0x7F);
+		if(status == VOICE_NOTE_ON && data[2]){
+			if(notes->count == notes->capacity){
+				notes_reserve(notes, notes->capacity ? notes->capacity * 2 : 64, &below);
+			}
+			size_t n = notes->count++;
+			notes->start[n] = ev.tick;
+			notes->end[n] = NOTE_OPEN;
+			notes->pitch[n] = data[1] & 0x7F;
+			notes->velocity[n] = data[2];
+			notes->channel[n] = data[0] & 0x0F;
+			notes->track[n] = ev.track;
+			below[n] = open[key];
+			open[key] = n;
+		} else if(open[key] != NO_NOTE){
+			size_t n = open[key];
+			notes->end[n] = ev.tick;
+			open[key] = below[n];
+		}
+	}
+	midi_merge_close(&merge);
+	free(below);
+
+	for(size_t i = 0; i < notes->count; ++i){
+		if(notes->end[i] == NOTE_OPEN){
+			notes->end[i] = last_tick;
+		}
+	}
+	notes->max_end = malloc(sizeof(uint64_t) * (notes->count ? notes->count : 1));
+	notes_index(notes, 0, notes->count);
+}
+
+void free_midi_notes(struct MidiNotes* notes){
+	free(notes->start);
+	notes->start = NULL;
+	free(notes->end);
+	notes->end = NULL;
+	free(notes->pitch);
+	notes->pitch = NULL;
+	free(notes->velocity);
+	notes->velocity = NULL;
+	free(notes->channel);
+	notes->channel = NULL;
+	free(notes->track);
+	notes->track = NULL;
+	free(notes->max_end);
+	notes->max_end = NULL;
+	notes->count = 0;
+	notes->capacity = 0;
+}
+
+static void notes_query(const struct MidiNotes* notes, size_t lo, size_t hi, uint64_t t0, uint64_t t1, size_t* out, size_t max, size_t* found){
+	while(lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+		if(notes->max_end[mid] <= t0){
+			//everything in this subtree has ended by t0
+			return;
+		}
+		notes_query(notes, lo, mid, t0, t1, out, max, found);
+		if(notes->start[mid] >= t1){
+			//and everything to the right starts too late
+			return;
+		}
+		if(notes->end[mid] > t0){
+			if(out && (*found) < max){
+				out[*found] = mid;
+			}
+			(*found)++;
+		}
+		lo = mid + 1;
+	}
+}
+
+size_t midi_notes_sounding(const struct MidiNotes* notes, uint64_t t0, uint64_t t1, size_t* out, size_t max){
+	size_t found = 0;
+	if(t0 < t1){
+		notes_query(notes, 0, notes->count, t0, t1, out, max, &found);
+	}
+	return found;
+}
@@ -0,0 +1,55 @@
+#ifndef MIDI_NOTES_H
+#define MIDI_NOTES_H
+
+#include "midi.h"
+
+/*
+ * The notes of a `Midi`, each paired from its note on and note off events.
+ *
+ * Every column is a contiguous array and note `i` is
+ *		pitch[i] on channel[i] of track[i], sounding from tick start[i] up to (not including) tick end[i]
+ * Notes are ordered by start, then by the order their note on events come in.
+ *
+ * `max_end` indexes the notes as an implicit balanced tree over the sorted array: the root of the range [lo, hi)
+ * is (lo + hi) / 2 and max_end[i] is the latest end of the notes in the subtree rooted at i.
+ * The columns may be read directly but should not be modified.
+ */
+struct MidiNotes {
+	size_t count;
+	size_t capacity;
+
+	uint64_t* start;
+	uint64_t* end;
+	uint8_t* pitch;
+	uint8_t* velocity;
+	uint8_t* channel;
+	uint16_t* track;
+
+	uint64_t* max_end;
+};
+
+/*
+ * Pairs up the notes of all the tracks of `midi` in a single pass.
+ *
+ * A note off, or a note on with velocity 0, ends the latest note still sounding with the same channel and pitch.
+ * Channels are shared between tracks, as they are on a device. Notes never ended are cut off at the last event of
+ * the file, and note offs with no note to end are ignored.
+ */
+void new_midi_notes(struct MidiNotes* notes, struct Midi* midi);
+/*
+ * Frees the columns of the notes.
+ *
+ * This does not free the notes themselves
+ */
+void free_midi_notes(struct MidiNotes* notes);
+
+/*
+ * Finds the notes sounding at any point in [t0, t1), i.e. with start < t1 and end > t0.
+ *
+ * Up to `max` of their indices are written to `out` in order, which may be NULL to only count them.
+ * Returns how many notes are sounding. Subtrees which end too early or start too late are skipped, so this takes
+ * O(k log n) at worst for k notes found instead of looking at every note
+ */
+size_t midi_notes_sounding(const struct MidiNotes* notes, uint64_t t0, uint64_t t1, size_t* out, size_t max);
+
+#endif /* MIDI_NOTES_H */
@@ -0,0 +1,230 @@
+#include "midi_packed.h"
+
+#include <string.h>
+
+void new_packed_track(struct MidiPackedTrack* track){
+	track->event_count = 0;
+	track->event_capacity = 0;
+
+	track->delta_time = NULL;
+	track->offset = NULL;
+	track->length = NULL;
+
+	track->pool = NULL;
+	track->pool_len = 0;
+	track->pool_capacity = 0;
+}
+
+void free_packed_track(struct MidiPackedTrack* track){
+	free(track->delta_time);
+	track->delta_time = NULL;
+	free(track->offset);
+	track->offset = NULL;
+	free(track->length);
+	track->length = NULL;
+	free(track->pool);
+	track->pool = NULL;
+
+	track->event_count = 0;
+	track->event_capacity = 0;
+	track->pool_len = 0;
+	track->pool_capacity = 0;
+}
+
+void packed_track_reserve(struct MidiPackedTrack* track, size_t events, size_t bytes){
+	if(events > track->event_capacity){
+		track->delta_time = realloc(track->delta_time, sizeof(uint32_t) * events);
+		track->offset = realloc(track->offset, sizeof(uint32_t) * events);
+		track->length = realloc(track->length, sizeof(uint32_t) * events);
+		track->event_capacity = events;
+	}
+	if(bytes > track->pool_capacity){
+		track->pool = realloc(track->pool, sizeof(uint8_t) * bytes);
+		track->pool_capacity = bytes;
+	}
+}
+
+void packed_track_add_event(struct MidiPackedTrack* track, uint32_t delta_time, const uint8_t* event_data, size_t event_data_len){
+	//grow geometrically so appending stays amortized O(1)
+	size_t events = track->event_capacity;
+	if(track->event_count == events){
+		events = events ? events * 2 : 16;
+	}
+	size_t bytes = track->pool_capacity;
+	while(track->pool_len + event_data_len > bytes){
+		bytes = bytes ? bytes * 2 : 64;
+	}
+	packed_track_reserve(track, events, bytes);
+
+	size_t i = track->event_count++;
+	track->delta_time[i] = delta_time;
+	track->offset[i] = (uint32_t) track->pool_len;
+	track->length[i] = (uint32_t) event_data_len;
+	memcpy(track->pool + track->pool_len, event_data, event_data_len);
+	track->pool_len += event_data_len;
+}
+
+const uint8_t* packed_track_event(const struct MidiPackedTrack* track, size_t i, size_t* event_len){
+	if(event_len){
+		(*event_len) = track->length[i];
+	}
+	return track->pool + track->offset[i];
+}
+
+int parse_packed_track(struct MidiPackedTrack* track, const uint8_t* data, size_t len){
+	//count the events and their bytes first so every column is allocated once
+	size_t count = 0;
+	size_t bytes = 0;
+	size_t read = 0;
+	uint8_t running_status = 0;
+	while(read < len){
+		uint32_t delta_time;
+		size_t delta_time_size;
+		size_t event_size;
+		if(parse_midi_event_bounds(data + read, len - read, &running_status, &delta_time, &delta_time_size, &event_size)){
+			return -1;
+		}
+		//events using running status are stored with their status byte
+		bytes += event_size + !(data[read + delta_time_size] & 0x80);
+		read += delta_time_size + event_size;
+		count++;
+	}
+	packed_track_reserve(track, track->event_count + count, track->pool_len + bytes);
+
+	read = 0;
+	running_status = 0;
+	for(size_t i = track->event_count; i < track->event_count + count; ++i){
+		size_t delta_time_size;
+		size_t event_size;
+		parse_midi_event_bounds(data + read, len - read, &running_status, &track->delta_time[i], &delta_time_size, &event_size);
+		read += delta_time_size;
+
+		uint8_t scratch[3];
+		size_t event_len = event_size;
+		const uint8_t* ev = midi_event_with_status(data + read, &event_len, running_status, scratch);
+		track->offset[i] = (uint32_t) track->pool_len;
+		track->length[i] = (uint32_t) event_len;
+		memcpy(track->pool + track->pool_len, ev, event_len);
+		track->pool_len += event_len;
+		read += event_size;
+	}
+	track->event_count += count;
+	return 0;
+}
+
+void packed_track_from_track(struct MidiPackedTrack* dest, const struct MidiTrackChunk* src){
+	size_t bytes = 0;
+	for(size_t i = 0; i < src->event_count; ++i){
+		bytes += src->events[i]->event_len;
+	}
+	packed_track_reserve(dest, dest->event_count + src->event_count, dest->pool_len + bytes);
+	for(size_t i = 0; i < src->event_count; ++i){
+		struct MidiEvent* e = src->events[i];
+		packed_track_add_event(dest, e->delta_time, midi_event_data(e), e->event_len);
+	}
+}
+
+void packed_track_to_track(const struct MidiPackedTrack* src, struct MidiTrackChunk* dest){
+	for(size_t i = 0; i < src->event_count; ++i){
+		track_add_event_full(dest, src->delta_time[i], src->pool + src->offset[i], src->length[i]);
+	}
+}
+
+size_t packed_track_length(const struct MidiPackedTrack* track){
+	size_t s = track->pool_len;
+	for(size_t i = 0; i < track->event_count; ++i){
+		s += varlen_size(track->delta_time[i]);
+	}
+	return s;
+}
+
+void write_packed_track(const struct MidiPackedTrack* track, FILE* f){
+	size_t length = packed_track_length(track);
+	fwrite("MTrk", sizeof(uint8_t), TYPE_LEN, f);
+	write_uint32_t(length, f);
+
+	//serialize the whole body first so it goes out in a single write
+	uint8_t* body = malloc(sizeof(uint8_t) * length);
+	size_t pos = 0;
+	for(size_t i = 0; i < track->event_count; ++i){
+		pos += varlen_encode(track->delta_time[i], body + pos);
+		memcpy(body + pos, track->pool + track->offset[i], track->length[i]);
+		pos += track->length[i];
+	}
+	fwrite(body, sizeof(uint8_t), length, f);
+	free(body);
+	body = NULL;
+}
+
+void new_midi_packed(struct MidiPacked* midi, uint16_t format, uint16_t division){
+	midi->format = format;
+	midi->division = division;
+	midi->track_count = 0;
+	midi->tracks = NULL;
+}
+
+void free_midi_packed(struct MidiPacked* midi){
+	for(uint16_t i = 0; i < midi->track_count; ++i){
+		free_packed_track(&midi->tracks[i]);
+	}
+	free(midi->tracks);
+	midi->tracks = NULL;
+	midi->track_count = 0;
+}
+
+struct MidiPackedTrack* midi_packed_add_track(struct MidiPacked* midi){
+	midi->tracks = realloc(midi->tracks, sizeof(struct MidiPackedTrack) * (midi->track_count + 1));
+	struct MidiPackedTrack* track = &midi->tracks[midi->track_count++];
+	new_packed_track(track);
+	return track;
+}
+
+struct MidiPacked* read_midi_packed_buffer(const uint8_t* data, size_t size){
+	if(size < TYPE_LEN + 4 + HEADER_LEN || memcmp(data, "MThd", TYPE_LEN) || load_uint32_t(data + TYPE_LEN) != HEADER_LEN){
+		return NULL;
+	}
+	const uint8_t* header = data + TYPE_LEN + 4;
+	struct MidiPacked* midi = malloc(sizeof(struct MidiPacked));
+	new_midi_packed(midi, load_uint16_t(header), load_uint16_t(header + 4));
+	uint16_t tracks = load_uint16_t(header + 2);
+	midi->tracks = malloc(sizeof(struct MidiPackedTrack) * (tracks ? tracks : 1));
+
+	size_t pos = TYPE_LEN + 4 + HEADER_LEN;
+	for(uint16_t i = 0; i < tracks; ++i){
+		if(size - pos < TYPE_LEN + 4 || load_uint32_t(data + pos + TYPE_LEN) > size - pos - TYPE_LEN - 4){
+			free_midi_packed(midi);
+			free(midi);
+			return NULL;
+		}
+		uint32_t size_track = load_uint32_t(data + pos + TYPE_LEN);
+		pos += TYPE_LEN + 4;
+		struct MidiPackedTrack* track = &midi->tracks[midi->track_count++];
+		new_packed_track(track);
+		if(parse_packed_track(track, data + pos, size_track)){
+			free_midi_packed(midi);
+			free(midi);
+			return NULL;
+		}
+		pos += size_track;
+	}
+	return midi;
+}
+
+struct MidiPacked* read_midi_packed(FILE* f){
+	size_t size;
+	uint8_t* data = read_remaining(f, &size);
+	struct MidiPacked* midi = read_midi_packed_buffer(data, size);
+	free(data);
+	return midi;
+}
+
+void write_midi_packed(const struct MidiPacked* midi, FILE* f){
+	fwrite("MThd", sizeof(uint8_t), TYPE_LEN, f);
+	write_uint32_t(HEADER_LEN, f);
+	write_uint16_t(midi->format, f);
+	write_uint16_t(midi->track_count, f);
+	write_uint16_t(midi->division, f);
+	for(uint16_t i = 0; i < midi->track_count; ++i){
+		write_packed_track(&midi->tracks[i], f);
+	}
+}
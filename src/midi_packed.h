@@ -0,0 +1,120 @@
+#ifndef MIDI_PACKED_H
+#define MIDI_PACKED_H
+
+#include "midi.h"
+
+/*
+ * A columnar alternative to `MidiTrackChunk`.
+ *
+ * Instead of an array of pointers to individually allocated `MidiEvent`s, every column is a single contiguous array
+ * and the bytes of all events are packed back to back in `pool`. Event `i` is
+ *		delta_time[i] ticks after the previous event, with the bytes pool[offset[i]] .. pool[offset[i] + length[i] - 1]
+ *
+ * Offsets and lengths are 32 bits since a track chunk's length cannot exceed that anyway.
+ * The columns may be read directly, but should only be modified through the functions below.
+ */
+struct MidiPackedTrack {
+	size_t event_count;
+	size_t event_capacity;
+
+	uint32_t* delta_time;
+	uint32_t* offset;
+	uint32_t* length;
+
+	uint8_t* pool;
+	size_t pool_len;
+	size_t pool_capacity;
+};
+
+/*
+ * Construct an empty packed track
+ */
+void new_packed_track(struct MidiPackedTrack* track);
+/*
+ * Free the columns of the packed track.
+ *
+ * This does not free the track itself
+ */
+void free_packed_track(struct MidiPackedTrack* track);
+
+/*
+ * Make sure the track can hold `events` events with `bytes` bytes of event data in total without growing
+ */
+void packed_track_reserve(struct MidiPackedTrack* track, size_t events, size_t bytes);
+
+/*
+ * Append an event to the end of the track. A copy of `event_data` is made into the pool
+ */
+void packed_track_add_event(struct MidiPackedTrack* track, uint32_t delta_time, const uint8_t* event_data, size_t event_data_len);
+
+/*
+ * Returns the bytes of event `i`, and its length in `event_len`
+ */
+const uint8_t* packed_track_event(const struct MidiPackedTrack* track, size_t i, size_t* event_len);
+
+/*
+ * Parses the body of a track chunk (the bytes after "MTrk" and the length) and appends its events to the track.
+ *
+ * The events are counted first so each column is allocated once. Events using running status are stored with their status byte.
+ * Returns 0 on success and -1 if the data is malformed, in which case the track is left unchanged
+ */
+int parse_packed_track(struct MidiPackedTrack* track, const uint8_t* data, size_t len);
+
+/*
+ * Converts between the two track representations. Events are appended to `dest`
+ */
+void packed_track_from_track(struct MidiPackedTrack* dest, const struct MidiTrackChunk* src);
+void packed_track_to_track(const struct MidiPackedTrack* src, struct MidiTrackChunk* dest);
+
+/*
+ * This calculates the size of the track chunk body, like `track_length`
+ */
+size_t packed_track_length(const struct MidiPackedTrack* track);
+/*
+ * Writes the track as a complete track chunk (including the "MTrk" header) to the given opened `FILE`
+ */
+void write_packed_track(const struct MidiPackedTrack* track, FILE* f);
+
+/*
+ * A whole MIDI file held in packed tracks, for reading, scanning and writing it without a `MidiEvent` per event
+ */
+struct MidiPacked {
+	uint16_t format;
+	uint16_t division;
+
+	uint16_t track_count;
+	struct MidiPackedTrack* tracks;
+};
+
+/*
+ * Construct an empty packed Midi, which tracks are added to with `midi_packed_add_track`
+ */
+void new_midi_packed(struct MidiPacked* midi, uint16_t format, uint16_t division);
+/*
+ * Free the tracks of the packed Midi.
+ *
+ * This does not free the Midi itself
+ */
+void free_midi_packed(struct MidiPacked* midi);
+/*
+ * Adds an empty track to the end of the packed Midi and returns it. It is valid until the next track is added
+ */
+struct MidiPackedTrack* midi_packed_add_track(struct MidiPacked* midi);
+
+/*
+ * Parses a MIDI file held in memory straight into packed tracks with `parse_packed_track`.
+ *
+ * The Midi is allocated, and is freed with `free_midi_packed` and `free`.
+ * Returns NULL if the file is not a valid MIDI file
+ */
+struct MidiPacked* read_midi_packed_buffer(const uint8_t* data, size_t size);
+/*
+ * Reads the rest of a `FILE` into packed tracks, like `read_midi_packed_buffer`
+ */
+struct MidiPacked* read_midi_packed(FILE* f);
+/*
+ * Writes the header and every track of the packed Midi to the given opened `FILE`
+ */
+void write_midi_packed(const struct MidiPacked* midi, FILE* f);
+
+#endif /* MIDI_PACKED_H */
@@ -0,0 +1,215 @@
+//for clock_nanosleep and the scheduling policies
+#define _POSIX_C_SOURCE 200809L
+
+#include "midi_play.h"
+#include "midi_merge.h"
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// how long either thread waits for the other when the queue is full or empty
+#define PLAY_POLL_NS 100000
+// the longest the playback thread sleeps before checking whether it has been stopped
+#define PLAY_SLICE_NS 50000000
+
+static uint64_t timespec_ns(const struct timespec* t){
+	return (uint64_t) t->tv_sec * 1000000000 + (uint64_t) t->tv_nsec;
+}
+
+static struct timespec ns_timespec(uint64_t ns){
+	struct timespec t;
+	t.tv_sec = (time_t) (ns / 1000000000);
+	t.tv_nsec = (long) (ns % 1000000000);
+	return t;
+}
+
+static void play_poll(void){
+	struct timespec wait = ns_timespec(PLAY_POLL_NS);
+	nanosleep(&wait, NULL);
+}
+
+static void* play_produce(void* arg){
+	struct MidiPlayer* player = (struct MidiPlayer*) arg;
+	struct MidiMerge merge;
+	midi_merge_open(&merge, player->midi);
+	struct MidiMergeEvent ev;
+	while(midi_merge_next(&merge, &ev)){
+		//the producer owns head, so only the playback thread's tail needs to be synchronized
+		while(player->head - __atomic_load_n(&player->tail, __ATOMIC_ACQUIRE) == PLAY_QUEUE_LEN){
+			if(__atomic_load_n(&player->stopped, __ATOMIC_RELAXED)){
+				midi_merge_close(&merge);
+				return NULL;
+			}
+			play_poll();
+		}
+		struct MidiPlayEvent* event = &player->queue[player->head & (PLAY_QUEUE_LEN - 1)];
+		event->us = tempo_map_tick_to_us(&player->tempo, ev.tick);
+		event->track = ev.track;
+		event->event = midi_event_data(ev.event);
+		event->event_len = ev.event->event_len;
+		__atomic_store_n(&player->head, player->head + 1, __ATOMIC_RELEASE);
+	}
+	midi_merge_close(&merge);
+	__atomic_store_n(&player->produced, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void* play_dispatch(void* arg){
+	struct MidiPlayer* player = (struct MidiPlayer*) arg;
+	//only succeeds with the privileges to, otherwise playback runs at normal priority
+	struct sched_param param;
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+	uint64_t start = timespec_ns(&player->start);
+	while(!__atomic_load_n(&player->stopped, __ATOMIC_RELAXED)){
+		if(player->tail == __atomic_load_n(&player->head, __ATOMIC_ACQUIRE)){
+			//produced has to be read before head is checked again, or the last events could be missed
+			if(__atomic_load_n(&player->produced, __ATOMIC_ACQUIRE) && player->tail == __atomic_load_n(&player->head, __ATOMIC_ACQUIRE)){
+				break;
+			}
+			play_poll();
+			continue;
+		}
+		struct MidiPlayEvent event = player->queue[player->tail & (PLAY_QUEUE_LEN - 1)];
+		__atomic_store_n(&player->tail, player->tail + 1, __ATOMIC_RELEASE);
+
+		uint64_t deadline_ns = start + event.us * 1000;
+		struct timespec now;
+		uint64_t now_ns;
+		while(1){
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			now_ns = timespec_ns(&now);
+			if(now_ns >= deadline_ns || __atomic_load_n(&player->stopped, __ATOMIC_RELAXED)){
+				break;
+			}
+			//a distant deadline is slept towards in slices so stopping does not wait for it
+			struct timespec wake = ns_timespec(deadline_ns - now_ns > PLAY_SLICE_NS ? now_ns + PLAY_SLICE_NS : deadline_ns);
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+		}
+		if(now_ns < deadline_ns){
+			break;
+		}
+		uint64_t jitter = now_ns > deadline_ns ? now_ns - deadline_ns : 0;
+		player->sink(&event, player->user);
+
+		player->stats.events++;
+		player->stats.total_jitter_ns += jitter;
+		if(jitter > player->stats.max_jitter_ns){
+			player->stats.max_jitter_ns = jitter;
+		}
+		if(jitter > PLAY_LATE_NS){
+			player->stats.late++;
+		}
+	}
+	return NULL;
+}
+
+int midi_player_start(struct MidiPlayer* player, struct Midi* midi, MidiPlaySink sink, void* user){
+	if(new_tempo_map(&player->tempo, midi)){
+		free_tempo_map(&player->tempo);
+		return -1;
+	}
+	player->midi = midi;
+	player->sink = sink;
+	player->user = user;
+	player->head = 0;
+	player->tail = 0;
+	player->produced = 0;
+	player->stopped = 0;
+	memset(&player->stats, 0, sizeof(player->stats));
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	player->start = ns_timespec(timespec_ns(&now) + PLAY_LEAD_NS);
+
+	if(pthread_create(&player->producer, NULL, play_produce, player)){
+		free_tempo_map(&player->tempo);
+		return -1;
+	}
+	if(pthread_create(&player->playback, NULL, play_dispatch, player)){
+		__atomic_store_n(&player->stopped, 1, __ATOMIC_RELAXED);
+		pthread_join(player->producer, NULL);
+		free_tempo_map(&player->tempo);
+		return -1;
+	}
+	return 0;
+}
+
+void midi_player_wait(struct MidiPlayer* player){
+	pthread_join(player->playback, NULL);
+	//the producer may still be waiting on a full queue if playback was stopped
+	__atomic_store_n(&player->stopped, 1, __ATOMIC_RELAXED);
+	pthread_join(player->producer, NULL);
+	free_tempo_map(&player->tempo);
+}
+
+void midi_player_stop(struct MidiPlayer* player){
+	__atomic_store_n(&player->stopped, 1, __ATOMIC_RELAXED);
+	midi_player_wait(player);
+}
+
+static void write_all(int fd, const uint8_t* data, size_t len){
+	while(len){
+		ssize_t n = write(fd, data, len);
+		if(n <= 0){
+			return;
+		}
+		data += n;
+		len -= (size_t) n;
+	}
+}
+
+void midi_play_sink_fd(const struct MidiPlayEvent* event, void* user){
+	int fd = *(int*) user;
+	const uint8_t* data = event->event;
+	if(!event->event_len || data[0] == 0xFF){
+		return;
+	}
+	if(data[0] == 0xF0 || data[0] == 0xF7){
+		//in a file sysex data is preceded by its length, which is not sent
+		uint32_t len;
+		size_t len_size;
+		if(varlen_to_int_checked(data + 1, event->event_len - 1, &len, &len_size)){
+			return;
+		}
+		if(data[0] == 0xF0){
+			write_all(fd, data, 1);
+		}
+		write_all(fd, data + 1 + len_size, event->event_len - 1 - len_size);
+		return;
+	}
+	write_all(fd, data, event->event_len);
+}
+
+void new_play_recorder(struct MidiPlayRecorder* recorder){
+	recorder->events = NULL;
+	recorder->dispatched_ns = NULL;
+	recorder->count = 0;
+	recorder->capacity = 0;
+}
+
+void free_play_recorder(struct MidiPlayRecorder* recorder){
+	free(recorder->events);
+	recorder->events = NULL;
+	free(recorder->dispatched_ns);
+	recorder->dispatched_ns = NULL;
+	recorder->count = 0;
+	recorder->capacity = 0;
+}
+
+void midi_play_sink_recorder(const struct MidiPlayEvent* event, void* user){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct MidiPlayRecorder* recorder = (struct MidiPlayRecorder*) user;
+	if(recorder->count == recorder->capacity){
+		recorder->capacity = recorder->capacity ? recorder->capacity * 2 : 64;
+		recorder->events = realloc(recorder->events, sizeof(struct MidiPlayEvent) * recorder->capacity);
+		recorder->dispatched_ns = realloc(recorder->dispatched_ns, sizeof(uint64_t) * recorder->capacity);
+	}
+	recorder->events[recorder->count] = *event;
+	recorder->dispatched_ns[recorder->count] = timespec_ns(&now);
+	recorder->count++;
+}
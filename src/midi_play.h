@@ -0,0 +1,119 @@
+#ifndef MIDI_PLAY_H
+#define MIDI_PLAY_H
+
+#include "midi.h"
+#include "midi_tempo.h"
+
+#include <pthread.h>
+
+// how many events the producer can get ahead of playback, must be a power of two
+#define PLAY_QUEUE_LEN 1024
+// how far behind its deadline an event is dispatched before it counts as late
+#define PLAY_LATE_NS 1000000
+// how long after starting the first event is due, which gives the producer a head start
+#define PLAY_LEAD_NS 10000000
+
+/*
+ * An event due to be played, at `us` µs from the start of playback.
+ *
+ * `event` points into the `Midi` being played
+ */
+struct MidiPlayEvent {
+	uint64_t us;
+	uint16_t track;
+
+	const uint8_t* event;
+	size_t event_len;
+};
+
+/*
+ * Called on the playback thread with each event once it is due.
+ *
+ * Sinks should return quickly, since anything they take delays the events after them
+ */
+typedef void (*MidiPlaySink)(const struct MidiPlayEvent* event, void* user);
+
+/*
+ * How closely playback kept to the deadlines of the events.
+ *
+ * Jitter is how long after its deadline each event was handed to the sink
+ */
+struct MidiPlayStats {
+	size_t events;
+	size_t late;
+
+	uint64_t max_jitter_ns;
+	uint64_t total_jitter_ns;
+};
+
+/*
+ * Plays a `Midi` in real time.
+ *
+ * A producer thread merges the tracks, converts the ticks to wall clock time and queues the events in a lock-free
+ * single producer single consumer ring. A playback thread (made real time if the process is allowed to) sleeps until
+ * each event's deadline with `clock_nanosleep` and hands it to the sink.
+ * The `Midi` must not be changed or freed until playback has finished.
+ */
+struct MidiPlayer {
+	struct Midi* midi;
+	struct MidiTempoMap tempo;
+
+	MidiPlaySink sink;
+	void* user;
+
+	// events queue[tail % PLAY_QUEUE_LEN] .. queue[(head - 1) % PLAY_QUEUE_LEN] are waiting. head is only written by
+	// the producer and tail only by the playback thread
+	struct MidiPlayEvent queue[PLAY_QUEUE_LEN];
+	size_t head;
+	size_t tail;
+	int produced;
+	int stopped;
+
+	struct timespec start;
+	pthread_t producer;
+	pthread_t playback;
+
+	struct MidiPlayStats stats;
+};
+
+/*
+ * Starts playing `midi` into `sink`. The first event is due PLAY_LEAD_NS after this is called.
+ *
+ * The tempo comes from `new_tempo_map`, so a format 2 file, whose tracks are separate sequences, is not played.
+ * Returns 0 on success and -1 if the `Midi` has no valid header, is format 2 or the threads could not be started
+ */
+int midi_player_start(struct MidiPlayer* player, struct Midi* midi, MidiPlaySink sink, void* user);
+/*
+ * Waits for playback to finish, or stops it early, then frees what the player holds.
+ *
+ * `player->stats` is complete once either returns
+ */
+void midi_player_wait(struct MidiPlayer* player);
+void midi_player_stop(struct MidiPlayer* player);
+
+/*
+ * A sink which writes the events to a file descriptor (e.g. a pipe or a raw MIDI device) in wire format.
+ *
+ * `user` points to the int file descriptor. Meta events are not sent, as they only exist in files
+ */
+void midi_play_sink_fd(const struct MidiPlayEvent* event, void* user);
+
+/*
+ * A sink which records the events with the time they were dispatched at, for tests and offline rendering
+ */
+struct MidiPlayRecorder {
+	struct MidiPlayEvent* events;
+	// when each event was dispatched, in ns on CLOCK_MONOTONIC
+	uint64_t* dispatched_ns;
+	size_t count;
+	size_t capacity;
+};
+
+void new_play_recorder(struct MidiPlayRecorder* recorder);
+void free_play_recorder(struct MidiPlayRecorder* recorder);
+/*
+ * `user` points to the `MidiPlayRecorder`
+ */
+void midi_play_sink_recorder(const struct MidiPlayEvent* event, void* user);
+
+#endif /* MIDI_PLAY_H */
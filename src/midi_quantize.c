@@ -0,0 +1,328 @@
+//for sysconf
+#define _POSIX_C_SOURCE 200809L
+
+#include "midi_quantize.h"
+#include "midi_constants.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+// marks an empty stack of notes
+#define NO_NOTE SIZE_MAX
+
+// numerators below this are divided exactly by multiplying with a `Reciprocal`
+#define RECIPROCAL_LIMIT ((uint64_t) 1 << 31)
+
+/*
+ * One track to retime, with the absolute tick each event moves to
+ */
+struct RetimeJob {
+	struct MidiChunk* chunk;
+	struct MidiTrackChunk* track;
+	uint64_t* retimed;
+	int failed;
+};
+
+struct RetimeJobs {
+	struct RetimeJob* jobs;
+	size_t count;
+	size_t next;
+
+	// quantizes to `grid` if set, otherwise rescales from `from` to `to`
+	uint64_t grid;
+	uint64_t from;
+	uint64_t to;
+};
+
+/*
+ * Divides numerators below RECIPROCAL_LIMIT by d with a multiply and a shift, which unlike a division can be
+ * vectorized: n / d == (n * multiplier) >> shift.
+ *
+ * With 2^(shift - 31) >= d, multiplier = ceil(2^shift / d) is within 2^(shift - 31) of a multiple of d, which
+ * makes the quotient exact for 31 bit numerators (Granlund and Montgomery). The product stays below 2^63
+ */
+struct Reciprocal {
+	uint64_t multiplier;
+	unsigned shift;
+};
+
+static struct Reciprocal reciprocal(uint64_t d){
+	unsigned bits = 0;
+	while(((uint64_t) 1 << bits) < d){
+		bits++;
+	}
+	struct Reciprocal r;
+	r.shift = 31 + bits;
+	r.multiplier = (((uint64_t) 1 << r.shift) + d - 1) / d;
+	return r;
+}
+
+static void rescale_ticks(const uint64_t* ticks, size_t count, uint64_t from, uint64_t to, uint64_t* out){
+	//split into whole quarter notes and the rest so tick * to cannot overflow
+	if(!count || ticks[count - 1] >= RECIPROCAL_LIMIT || (from - 1) * to + from / 2 >= RECIPROCAL_LIMIT){
+		for(size_t i = 0; i < count; ++i){
+			uint64_t whole = ticks[i] / from;
+			uint64_t part = ticks[i] % from;
+			out[i] = whole * to + (part * to + from / 2) / from;
+		}
+		return;
+	}
+	//the ticks are in order, so if the last fits every one does
+	struct Reciprocal r = reciprocal(from);
+	for(size_t i = 0; i < count; ++i){
+		uint64_t whole = (ticks[i] * r.multiplier) >> r.shift;
+		uint64_t part = ticks[i] - whole * from;
+		out[i] = whole * to + (((part * to + from / 2) * r.multiplier) >> r.shift);
+	}
+}
+
+static void round_to_grid(const uint64_t* ticks, size_t count, uint64_t grid, uint64_t* out){
+	if(!count || ticks[count - 1] + grid / 2 >= RECIPROCAL_LIMIT){
+		for(size_t i = 0; i < count; ++i){
+			out[i] = (ticks[i] + grid / 2) / grid * grid;
+		}
+		return;
+	}
+	struct Reciprocal r = reciprocal(grid);
+	for(size_t i = 0; i < count; ++i){
+		out[i] = (((ticks[i] + grid / 2) * r.multiplier) >> r.shift) * grid;
+	}
+}
+
+/*
+ * Works out the quantized tick of every event, keeping the events in order
+ */
+static void quantize_ticks(struct MidiTrackChunk* track, const uint64_t* ticks, uint64_t grid, uint64_t* out){
+	size_t count = track->event_count;
+	round_to_grid(ticks, count, grid, out);
+
+	//only note ons keep those ticks. Note offs are paired up with them the way `new_midi_notes` does, the latest
+	//note still sounding for each channel and pitch linking to the one below it, and move by as much
+	size_t open[16 * 128];
+	for(size_t i = 0; i < 16 * 128; ++i){
+		open[i] = NO_NOTE;
+	}
+	size_t* below = malloc(sizeof(size_t) * (count ? count : 1));
+	// the channel and pitch of each note on, and of each note off paired with one, plus 1
+	uint16_t* note = malloc(sizeof(uint16_t) * (count ? count : 1));
+	uint8_t* onset = malloc(sizeof(uint8_t) * (count ? count : 1));
+	for(size_t i = 0; i < count; ++i){
+		struct MidiEvent* e = track->events[i];
+		const uint8_t* data = midi_event_data(e);
+		uint8_t status = e->event_len == 3 ? data[0] & 0xF0 : 0;
+		size_t key = status ? (size_t) (data[0] & 0x0F) * 128 + (data[1] & 0x7F) : 0;
+		onset[i] = status == VOICE_NOTE_ON && data[2];
+		note[i] = 0;
+		if(onset[i]){
+			below[i] = open[key];
+			open[key] = i;
+			note[i] = (uint16_t) (key + 1);
+		} else if((status == VOICE_NOTE_ON || status == VOICE_NOTE_OFF) && open[key] != NO_NOTE){
+			size_t on = open[key];
+			out[i] = out[on] + (ticks[i] - ticks[on]);
+			open[key] = below[on];
+			note[i] = (uint16_t) (key + 1);
+		} else {
+			out[i] = ticks[i];
+		}
+	}
+	free(below);
+
+	//a note off cannot move past the next note on of the same pitch, or it would end that note instead
+	uint64_t next_onset[16 * 128];
+	for(size_t i = 0; i < 16 * 128; ++i){
+		next_onset[i] = UINT64_MAX;
+	}
+	for(size_t i = count; i-- > 0;){
+		if(onset[i]){
+			next_onset[note[i] - 1] = out[i];
+		} else if(note[i] && out[i] > next_onset[note[i] - 1]){
+			out[i] = next_onset[note[i] - 1];
+		}
+	}
+	free(note);
+	free(onset);
+
+	//the events keep their order, so one moved earlier than an event before it is held at that event's tick
+	for(size_t i = 1; i < count; ++i){
+		if(out[i] < out[i - 1]){
+			out[i] = out[i - 1];
+		}
+	}
+}
+
+static int retime_track(struct RetimeJob* job, const struct RetimeJobs* jobs){
+	struct MidiTrackChunk* track = job->track;
+	const uint64_t* ticks = track_ticks(track);
+	job->retimed = malloc(sizeof(uint64_t) * (track->event_count ? track->event_count : 1));
+	if(jobs->grid){
+		quantize_ticks(track, ticks, jobs->grid, job->retimed);
+	} else {
+		rescale_ticks(ticks, track->event_count, jobs->from, jobs->to, job->retimed);
+	}
+
+	uint64_t last = 0;
+	for(size_t i = 0; i < track->event_count; ++i){
+		if(job->retimed[i] - last > VARLEN_MAX){
+			return -1;
+		}
+		last = job->retimed[i];
+	}
+	return 0;
+}
+
+/*
+ * Moves the events of the track to their new ticks. Returns 0 on success and -1 if the track is shared with a clone,
+ * in which case it is left unchanged
+ */
+static int commit_track(struct RetimeJob* job){
+	struct MidiTrackChunk* track = job->track;
+	//changing a shared track would change it under every clone, so it has to be copied with
+	//`midi_chunk_track_writable` first
+	if(__atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) != 1){
+		return -1;
+	}
+	uint64_t last = 0;
+	for(size_t i = 0; i < track->event_count; ++i){
+		track->events[i]->delta_time = (uint32_t) (job->retimed[i] - last);
+		last = job->retimed[i];
+	}
+	track_invalidate_ticks(track, 0);
+	return 0;
+}
+
+static void* retime_worker(void* arg){
+	struct RetimeJobs* jobs = (struct RetimeJobs*) arg;
+	size_t i;
+	while((i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED)) < jobs->count){
+		struct RetimeJob* job = &jobs->jobs[i];
+		job->failed = retime_track(job, jobs);
+	}
+	return NULL;
+}
+
+/*
+ * Works out the new ticks of every track, on several threads if asked to, then changes the tracks only if they all
+ * could be retimed
+ */
+static int retime_midi(struct Midi* midi, struct RetimeJobs* jobs, unsigned threads){
+	//tracks are decoded here, as that is not safe to do on several threads. Tracks shared with a clone are only
+	//read until they are known to change
+	jobs->jobs = malloc(sizeof(struct RetimeJob) * (midi->chunk_count ? midi->chunk_count : 1));
+	jobs->count = 0;
+	jobs->next = 0;
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		struct MidiTrackChunk* track = midi_chunk_track(midi->chunks[i]);
+		if(track){
+			struct RetimeJob* job = &jobs->jobs[jobs->count++];
+			job->chunk = midi->chunks[i];
+			job->track = track;
+			job->retimed = NULL;
+			job->failed = 0;
+		}
+	}
+
+	if(!threads){
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (unsigned) cores : 1;
+	}
+	if(threads > jobs->count){
+		threads = jobs->count;
+	}
+	if(threads > 1){
+		pthread_t* workers = malloc(sizeof(pthread_t) * (threads - 1));
+		size_t started = 0;
+		for(; started < threads - 1; ++started){
+			if(pthread_create(&workers[started], NULL, retime_worker, jobs)){
+				break;
+			}
+		}
+		//this thread takes part too, so the work still gets done if no thread could be started
+		retime_worker(jobs);
+		for(size_t i = 0; i < started; ++i){
+			pthread_join(workers[i], NULL);
+		}
+		free(workers);
+	} else {
+		retime_worker(jobs);
+	}
+
+	int result = 0;
+	for(size_t i = 0; i < jobs->count; ++i){
+		if(jobs->jobs[i].failed){
+			result = -1;
+		}
+	}
+	for(size_t i = 0; i < jobs->count; ++i){
+		if(!result){
+			//a copy has its events in the same order, so the new ticks still line up
+			jobs->jobs[i].track = midi_chunk_track_writable(jobs->jobs[i].chunk);
+			commit_track(&jobs->jobs[i]);
+		}
+		free(jobs->jobs[i].retimed);
+	}
+	free(jobs->jobs);
+	return result;
+}
+
+static int retime_single_track(struct MidiTrackChunk* track, struct RetimeJobs* jobs){
+	struct RetimeJob job = {NULL, track, NULL, 0};
+	int result = retime_track(&job, jobs);
+	if(!result){
+		result = commit_track(&job);
+	}
+	free(job.retimed);
+	return result;
+}
+
+int track_rescale_division(struct MidiTrackChunk* track, uint16_t from, uint16_t to){
+	if(!from || !to){
+		return -1;
+	}
+	struct RetimeJobs jobs = {NULL, 0, 0, 0, from, to};
+	return retime_single_track(track, &jobs);
+}
+
+int track_quantize(struct MidiTrackChunk* track, uint32_t grid){
+	if(!grid){
+		return -1;
+	}
+	struct RetimeJobs jobs = {NULL, 0, 0, grid, 0, 0};
+	return retime_single_track(track, &jobs);
+}
+
+int midi_rescale_division_parallel(struct Midi* midi, uint16_t division, unsigned threads){
+	if(!midi->header){
+		return -1;
+	}
+	uint16_t from = midi->header->division;
+	//SMPTE divisions have the high bit set
+	if(!from || !division || (from & 0x8000) || (division & 0x8000)){
+		return -1;
+	}
+	if(from == division){
+		return 0;
+	}
+	struct RetimeJobs jobs = {NULL, 0, 0, 0, from, division};
+	if(retime_midi(midi, &jobs, threads)){
+		return -1;
+	}
+	midi->header->division = division;
+	return 0;
+}
+
+int midi_quantize_parallel(struct Midi* midi, uint32_t grid, unsigned threads){
+	if(!grid){
+		return -1;
+	}
+	struct RetimeJobs jobs = {NULL, 0, 0, grid, 0, 0};
+	return retime_midi(midi, &jobs, threads);
+}
+
+int midi_rescale_division(struct Midi* midi, uint16_t division){
+	return midi_rescale_division_parallel(midi, division, 1);
+}
+
+int midi_quantize(struct Midi* midi, uint32_t grid){
+	return midi_quantize_parallel(midi, grid, 1);
+}
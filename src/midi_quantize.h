@@ -0,0 +1,54 @@
+#ifndef MIDI_QUANTIZE_H
+#define MIDI_QUANTIZE_H
+
+#include "midi.h"
+
+/*
+ * Rescales the delta times of a track from `from` ticks per quarter note to `to`.
+ *
+ * Event ticks are rescaled from their absolute ticks, so rounding errors do not add up along the track. Tick t becomes
+ * t * to / from, rounded to the nearest tick with halves rounding up. The rounding is the same for every event, so
+ * the events keep their order and note durations scale with the notes.
+ * The division is done with a multiply and a shift where the ticks allow, so the loop over the ticks can be vectorized.
+ * Returns 0 on success and -1 if `from` or `to` is 0, a delta time would no longer fit in a varlen or the track is
+ * shared with a clone (fetch it with `midi_track_writable` first), in which case the track is left unchanged
+ */
+int track_rescale_division(struct MidiTrackChunk* track, uint16_t from, uint16_t to);
+/*
+ * Moves every note on of a track to the nearest multiple of `grid` ticks, with halves rounding up.
+ *
+ * A note off, or a note on with velocity 0, moves with the latest note still sounding with the same channel and
+ * pitch, so notes keep their durations. Other events keep their ticks.
+ * The events keep their order, so an event which would move before the event ahead of it is held at that event's
+ * tick instead, and a note off which would move past the next note on of the same channel and pitch is held at that
+ * note on's tick so it still ends its own note. These are the only times a note does not keep its duration, or a
+ * note on does not land on the grid.
+ * Returns 0 on success and -1 if `grid` is 0, a delta time would no longer fit in a varlen or the track is shared
+ * with a clone (fetch it with `midi_track_writable` first), in which case the track is left unchanged
+ */
+int track_quantize(struct MidiTrackChunk* track, uint32_t grid);
+
+/*
+ * Rescales every track of the Midi to `division` ticks per quarter note, and sets the division in its header.
+ *
+ * Each track is rescaled as by `track_rescale_division`. Tracks shared with a clone are only copied with
+ * `midi_track_writable` once every track is known to rescale.
+ * Returns 0 on success and -1 if the Midi has no header, either division is 0 or in SMPTE frames, or a track could not
+ * be rescaled, in which case no track is changed
+ */
+int midi_rescale_division(struct Midi* midi, uint16_t division);
+/*
+ * Quantizes every track of the Midi to a grid of `grid` ticks as `track_quantize` does.
+ *
+ * Returns 0 on success and -1 if `grid` is 0 or a track could not be quantized, in which case no track is changed
+ */
+int midi_quantize(struct Midi* midi, uint32_t grid);
+
+/*
+ * Like `midi_rescale_division` and `midi_quantize`, but working on the tracks concurrently on `threads` threads
+ * (0 uses one per core). Tracks do not depend on each other, so the result is the same
+ */
+int midi_rescale_division_parallel(struct Midi* midi, uint16_t division, unsigned threads);
+int midi_quantize_parallel(struct Midi* midi, uint32_t grid, unsigned threads);
+
+#endif /* MIDI_QUANTIZE_H */
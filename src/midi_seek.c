@@ -0,0 +1,225 @@
+#include "midi_seek.h"
+
+#include <string.h>
+
+// identifies a saved seek index, and the version of its layout
+#define SEEK_MAGIC "MSix"
+#define SEEK_VERSION 1
+
+/*
+ * Records the checkpoints of the track body data[offset] .. data[offset + length - 1]
+ */
+static int seek_index_track(struct MidiSeekTrack* track, const uint8_t* data, uint64_t offset, uint32_t length, uint32_t interval){
+	track->offset = offset;
+	track->length = length;
+	track->points = NULL;
+	track->point_count = 0;
+	size_t capacity = 0;
+
+	const uint8_t* body = data + offset;
+	size_t read = 0;
+	uint64_t tick = 0;
+	uint8_t running_status = 0;
+	for(uint32_t event = 0; read < length; ++event){
+		if(event % interval == 0){
+			if(track->point_count == capacity){
+				capacity = capacity ? capacity * 2 : 4;
+				track->points = realloc(track->points, sizeof(struct MidiSeekPoint) * capacity);
+			}
+			struct MidiSeekPoint* point = &track->points[track->point_count++];
+			point->offset = offset + read;
+			point->tick = tick;
+			point->event = event;
+			point->running_status = running_status;
+		}
+		uint32_t delta_time;
+		size_t delta_time_size;
+		size_t event_size;
+		if(parse_midi_event_bounds(body + read, length - read, &running_status, &delta_time, &delta_time_size, &event_size)){
+			return -1;
+		}
+		read += delta_time_size + event_size;
+		tick += delta_time;
+	}
+	if(!track->point_count){
+		//an empty track still starts somewhere
+		track->points = malloc(sizeof(struct MidiSeekPoint));
+		track->points[0].offset = offset;
+		track->points[0].tick = 0;
+		track->points[0].event = 0;
+		track->points[0].running_status = 0;
+		track->point_count = 1;
+	}
+	return 0;
+}
+
+int new_seek_index(struct MidiSeekIndex* index, const uint8_t* data, size_t size, uint32_t interval){
+	index->interval = interval ? interval : SEEK_INTERVAL;
+	index->tracks = NULL;
+	index->track_count = 0;
+
+	if(size < TYPE_LEN + 4 + HEADER_LEN || memcmp(data, "MThd", TYPE_LEN)){
+		return -1;
+	}
+	uint32_t size_head = load_uint32_t(data + TYPE_LEN);
+	uint16_t tracks = load_uint16_t(data + TYPE_LEN + 6);
+	if(size_head < HEADER_LEN || size - TYPE_LEN - 4 < size_head){
+		return -1;
+	}
+	index->tracks = malloc(sizeof(struct MidiSeekTrack) * (tracks ? tracks : 1));
+
+	size_t pos = TYPE_LEN + 4 + size_head;
+	while(index->track_count < tracks){
+		if(size - pos < TYPE_LEN + 4){
+			free_seek_index(index);
+			return -1;
+		}
+		uint32_t length = load_uint32_t(data + pos + TYPE_LEN);
+		int is_track = !memcmp(data + pos, "MTrk", TYPE_LEN);
+		pos += TYPE_LEN + 4;
+		if(size - pos < length){
+			free_seek_index(index);
+			return -1;
+		}
+		if(is_track){
+			struct MidiSeekTrack* track = &index->tracks[index->track_count++];
+			if(seek_index_track(track, data, pos, length, index->interval)){
+				free_seek_index(index);
+				return -1;
+			}
+		}
+		pos += length;
+	}
+	return 0;
+}
+
+void free_seek_index(struct MidiSeekIndex* index){
+	for(uint16_t i = 0; i < index->track_count; ++i){
+		free(index->tracks[i].points);
+	}
+	free(index->tracks);
+	index->tracks = NULL;
+	index->track_count = 0;
+}
+
+const struct MidiSeekPoint* seek_index_find(const struct MidiSeekIndex* index, uint16_t track, uint64_t tick){
+	if(track >= index->track_count){
+		return NULL;
+	}
+	const struct MidiSeekTrack* t = &index->tracks[track];
+	//the last checkpoint whose previous event is before `tick`. The first checkpoint has no previous event
+	size_t low = 0;
+	size_t high = t->point_count;
+	while(high - low > 1){
+		size_t mid = low + (high - low) / 2;
+		if(t->points[mid].tick < tick){
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return &t->points[low];
+}
+
+static void write_uint64_t(uint64_t data, FILE* f){
+	write_uint32_t((uint32_t) (data >> 32), f);
+	write_uint32_t((uint32_t) data, f);
+}
+
+int write_seek_index(const struct MidiSeekIndex* index, FILE* f){
+	fwrite(SEEK_MAGIC, sizeof(uint8_t), TYPE_LEN, f);
+	write_uint16_t(SEEK_VERSION, f);
+	write_uint32_t(index->interval, f);
+	write_uint16_t(index->track_count, f);
+	for(uint16_t i = 0; i < index->track_count; ++i){
+		const struct MidiSeekTrack* track = &index->tracks[i];
+		write_uint64_t(track->offset, f);
+		write_uint32_t(track->length, f);
+		write_uint32_t((uint32_t) track->point_count, f);
+		for(size_t p = 0; p < track->point_count; ++p){
+			const struct MidiSeekPoint* point = &track->points[p];
+			write_uint64_t(point->offset, f);
+			write_uint64_t(point->tick, f);
+			write_uint32_t(point->event, f);
+			fputc(point->running_status, f);
+		}
+	}
+	return ferror(f) ? -1 : 0;
+}
+
+// the size of a saved checkpoint
+#define SEEK_POINT_LEN 21
+
+int read_seek_index(struct MidiSeekIndex* index, FILE* f){
+	index->tracks = NULL;
+	index->track_count = 0;
+
+	uint8_t head[TYPE_LEN + 8];
+	if(fread(head, sizeof(uint8_t), sizeof(head), f) != sizeof(head) ||
+			memcmp(head, SEEK_MAGIC, TYPE_LEN) || load_uint16_t(head + TYPE_LEN) != SEEK_VERSION){
+		return -1;
+	}
+	index->interval = load_uint32_t(head + TYPE_LEN + 2);
+	uint16_t tracks = load_uint16_t(head + TYPE_LEN + 6);
+	index->tracks = malloc(sizeof(struct MidiSeekTrack) * (tracks ? tracks : 1));
+
+	while(index->track_count < tracks){
+		uint8_t track_head[16];
+		if(fread(track_head, sizeof(uint8_t), sizeof(track_head), f) != sizeof(track_head)){
+			free_seek_index(index);
+			return -1;
+		}
+		struct MidiSeekTrack* track = &index->tracks[index->track_count++];
+		track->offset = (uint64_t) load_uint32_t(track_head) << 32 | load_uint32_t(track_head + 4);
+		track->length = load_uint32_t(track_head + 8);
+		track->point_count = load_uint32_t(track_head + 12);
+		track->points = NULL;
+		if(!track->point_count){
+			free_seek_index(index);
+			return -1;
+		}
+		//read in one go, then unpacked in place from the back so nothing is overwritten before it is read
+		track->points = malloc(sizeof(struct MidiSeekPoint) * track->point_count);
+		uint8_t* raw = (uint8_t*) track->points;
+		if(!raw || fread(raw, SEEK_POINT_LEN, track->point_count, f) != track->point_count){
+			free_seek_index(index);
+			return -1;
+		}
+		for(size_t p = track->point_count; p-- > 0;){
+			const uint8_t* saved = raw + p * SEEK_POINT_LEN;
+			struct MidiSeekPoint point;
+			point.offset = (uint64_t) load_uint32_t(saved) << 32 | load_uint32_t(saved + 4);
+			point.tick = (uint64_t) load_uint32_t(saved + 8) << 32 | load_uint32_t(saved + 12);
+			point.event = load_uint32_t(saved + 16);
+			point.running_status = saved[20];
+			track->points[p] = point;
+		}
+	}
+	return 0;
+}
+
+const struct MidiSeekPoint* midi_reader_seek(struct MidiReader* reader, const struct MidiSeekIndex* index, uint16_t track, uint64_t tick){
+	const struct MidiSeekPoint* point = seek_index_find(index, track, tick);
+	if(!point){
+		return NULL;
+	}
+	const struct MidiSeekTrack* t = &index->tracks[track];
+	if(reader->f){
+		if(fseek(reader->f, (long) point->offset, SEEK_SET)){
+			return NULL;
+		}
+		//the window no longer matches the position of the file
+		reader->window = reader->buffer;
+		reader->window_len = 0;
+		reader->window_pos = 0;
+	} else {
+		if(point->offset > reader->window_len){
+			return NULL;
+		}
+		reader->window_pos = point->offset;
+	}
+	reader->track = track;
+	reader->track_remaining = (uint32_t) (t->offset + t->length - point->offset);
+	reader->running_status = point->running_status;
+	return point;
+}
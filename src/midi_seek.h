@@ -0,0 +1,85 @@
+#ifndef MIDI_SEEK_H
+#define MIDI_SEEK_H
+
+#include "midi.h"
+#include "midi_stream.h"
+
+// how many events apart the checkpoints of a seek index are by default
+#define SEEK_INTERVAL 1024
+
+/*
+ * A place in a track where decoding can start from.
+ *
+ * Delta times and running status make it impossible to start decoding at an arbitrary byte of a track, so the
+ * checkpoint records everything decoding needs at the start of one event
+ */
+struct MidiSeekPoint {
+	// of the event's delta time, from the start of the file
+	uint64_t offset;
+	// the absolute tick of the event before it, which the event's delta time is added to
+	uint64_t tick;
+	// the index of the event within its track
+	uint32_t event;
+	uint8_t running_status;
+};
+
+/*
+ * The checkpoints of one track. The first is always at the start of the track
+ */
+struct MidiSeekTrack {
+	// the body of the track chunk, from the start of the file
+	uint64_t offset;
+	uint32_t length;
+
+	struct MidiSeekPoint* points;
+	size_t point_count;
+};
+
+/*
+ * A sparse index of a MIDI file, holding a checkpoint every `interval` events of each track.
+ *
+ * It can be saved next to the file with `write_seek_index` so it only has to be built once.
+ */
+struct MidiSeekIndex {
+	uint32_t interval;
+
+	struct MidiSeekTrack* tracks;
+	uint16_t track_count;
+};
+
+/*
+ * Builds the seek index of a MIDI file held in memory (e.g. mapped by `open_midi_mmap`) in a single pass.
+ *
+ * `interval` of 0 uses SEEK_INTERVAL. Returns 0 on success and -1 if the file is malformed
+ */
+int new_seek_index(struct MidiSeekIndex* index, const uint8_t* data, size_t size, uint32_t interval);
+/*
+ * Frees the checkpoints of the index.
+ *
+ * This does not free the index itself
+ */
+void free_seek_index(struct MidiSeekIndex* index);
+
+/*
+ * Returns the last checkpoint of `track` from which every event at or after `tick` is still ahead, or NULL if
+ * there is no such track
+ */
+const struct MidiSeekPoint* seek_index_find(const struct MidiSeekIndex* index, uint16_t track, uint64_t tick);
+
+/*
+ * Saves the index to, or loads it from, an opened `FILE`. Returns 0 on success and -1 on failure
+ */
+int write_seek_index(const struct MidiSeekIndex* index, FILE* f);
+int read_seek_index(struct MidiSeekIndex* index, FILE* f);
+
+/*
+ * Moves the reader to the checkpoint of `track` found by `seek_index_find`, so the next event it yields is the
+ * checkpoint's event. The reader carries on through the rest of the file from there.
+ *
+ * The reader must be on the file the index was built from. A `FILE` must be seekable and start at the start of
+ * the MIDI file. The events before `tick` between the checkpoint and `tick` are yielded too, so the checkpoint is
+ * returned for the caller to count ticks from. Returns NULL if the reader could not be moved
+ */
+const struct MidiSeekPoint* midi_reader_seek(struct MidiReader* reader, const struct MidiSeekIndex* index, uint16_t track, uint64_t tick);
+
+#endif /* MIDI_SEEK_H */
@@ -0,0 +1,312 @@
+#include "midi_stream.h"
+
+#include <string.h>
+
+/*
+ * Makes at least `want` unconsumed bytes available in the window if the input still has them.
+ *
+ * Returns the number of unconsumed bytes available, which is less than `want` only at the end of the input
+ */
+static size_t reader_fill(struct MidiReader* reader, size_t want){
+	size_t available = reader->window_len - reader->window_pos;
+	if(available >= want || !reader->f){
+		return available;
+	}
+	//move what is left to the front of the buffer and read in behind it
+	memmove(reader->buffer, reader->window + reader->window_pos, available);
+	if(want > reader->buffer_capacity){
+		//a single event is larger than the buffer
+		size_t capacity = reader->buffer_capacity * 2;
+		while(capacity < want){
+			capacity *= 2;
+		}
+		reader->buffer = realloc(reader->buffer, capacity);
+		reader->buffer_capacity = capacity;
+	}
+	size_t read = fread(reader->buffer + available, sizeof(uint8_t), reader->buffer_capacity - available, reader->f);
+	reader->window = reader->buffer;
+	reader->window_len = available + read;
+	reader->window_pos = 0;
+	return reader->window_len;
+}
+
+/*
+ * Consumes `len` bytes of the input without looking at them
+ */
+static int reader_skip(struct MidiReader* reader, size_t len){
+	while(len){
+		size_t available = reader_fill(reader, 1);
+		if(!available){
+			return -1;
+		}
+		size_t n = available < len ? available : len;
+		reader->window_pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int reader_open(struct MidiReader* reader){
+	reader->track = -1;
+	reader->track_remaining = 0;
+	reader->running_status = 0;
+
+	uint8_t header[TYPE_LEN + 4 + HEADER_LEN];
+	if(reader_fill(reader, sizeof(header)) < sizeof(header)){
+		return -1;
+	}
+	memcpy(header, reader->window + reader->window_pos, sizeof(header));
+	uint32_t size_head = load_uint32_t(header + TYPE_LEN);
+	if(memcmp(header, "MThd", TYPE_LEN) || size_head < HEADER_LEN){
+		return -1;
+	}
+	reader->window_pos += sizeof(header);
+	reader->format = load_uint16_t(header + TYPE_LEN + 4);
+	reader->tracks = load_uint16_t(header + TYPE_LEN + 6);
+	reader->division = load_uint16_t(header + TYPE_LEN + 8);
+	//later versions of the format may extend the header
+	return reader_skip(reader, size_head - HEADER_LEN);
+}
+
+int midi_reader_open_file(struct MidiReader* reader, FILE* f){
+	reader->f = f;
+	reader->buffer = malloc(sizeof(uint8_t) * READER_BUFFER_LEN);
+	reader->buffer_capacity = READER_BUFFER_LEN;
+	reader->window = reader->buffer;
+	reader->window_len = 0;
+	reader->window_pos = 0;
+	if(reader_open(reader)){
+		midi_reader_close(reader);
+		return -1;
+	}
+	return 0;
+}
+
+int midi_reader_open_buffer(struct MidiReader* reader, const uint8_t* data, size_t size){
+	reader->f = NULL;
+	reader->buffer = NULL;
+	reader->buffer_capacity = 0;
+	reader->window = data;
+	reader->window_len = size;
+	reader->window_pos = 0;
+	return reader_open(reader);
+}
+
+int midi_reader_next_event(struct MidiReader* reader, struct MidiReaderEvent* event){
+	while(!reader->track_remaining){
+		//move on to the next track chunk
+		if(reader->track + 1 >= reader->tracks){
+			return 0;
+		}
+		if(reader_fill(reader, TYPE_LEN + 4) < TYPE_LEN + 4){
+			return -1;
+		}
+		const uint8_t* chunk_head = reader->window + reader->window_pos;
+		int is_track = !memcmp(chunk_head, "MTrk", TYPE_LEN);
+		uint32_t size = load_uint32_t(chunk_head + TYPE_LEN);
+		reader->window_pos += TYPE_LEN + 4;
+		if(!is_track){
+			if(reader_skip(reader, size)){
+				return -1;
+			}
+			continue;
+		}
+		reader->track++;
+		reader->track_remaining = size;
+		reader->running_status = 0;
+	}
+
+	//most events fit in a few bytes, only ask for more when an event does not fit in what is available
+	size_t want = 16;
+	uint32_t delta_time;
+	size_t delta_time_size;
+	size_t event_size;
+	while(1){
+		size_t limit = want < reader->track_remaining ? want : reader->track_remaining;
+		size_t available = reader_fill(reader, limit);
+		if(available > reader->track_remaining){
+			available = reader->track_remaining;
+		}
+		uint8_t running_status = reader->running_status;
+		if(!parse_midi_event_bounds(reader->window + reader->window_pos, available, &running_status, &delta_time, &delta_time_size, &event_size)){
+			reader->running_status = running_status;
+			break;
+		}
+		if(available < limit || available == reader->track_remaining){
+			//either the input ended or the event runs past the end of the track
+			return -1;
+		}
+		want = available * 2;
+	}
+
+	event->track = (uint16_t) reader->track;
+	event->delta_time = delta_time;
+	event->event_len = event_size;
+	event->event = midi_event_with_status(reader->window + reader->window_pos + delta_time_size, &event->event_len, reader->running_status, reader->status_event);
+
+	reader->window_pos += delta_time_size + event_size;
+	reader->track_remaining -= delta_time_size + event_size;
+	return 1;
+}
+
+void midi_reader_close(struct MidiReader* reader){
+	free(reader->buffer);
+	reader->buffer = NULL;
+	reader->buffer_capacity = 0;
+	reader->window = NULL;
+	reader->window_len = 0;
+	reader->window_pos = 0;
+}
+
+static void writer_put(struct MidiWriter* writer, const uint8_t* data, size_t len){
+	if(fwrite(data, sizeof(uint8_t), len, writer->f) != len){
+		writer->failed = 1;
+	}
+}
+
+/*
+ * Adds bytes to a track whose length is not known yet on a `FILE` which cannot be seeked
+ */
+static void writer_spill(struct MidiWriter* writer, const uint8_t* data, size_t len){
+	if(writer->spill_len + len > WRITER_SPILL_LEN){
+		if(!writer->spill_file){
+			writer->spill_file = tmpfile();
+		}
+		if(!writer->spill_file || 
+				fwrite(writer->spill, sizeof(uint8_t), writer->spill_len, writer->spill_file) != writer->spill_len ||
+				fwrite(data, sizeof(uint8_t), len, writer->spill_file) != len){
+			writer->failed = 1;
+		}
+		writer->spill_len = 0;
+		return;
+	}
+	memcpy(writer->spill + writer->spill_len, data, len);
+	writer->spill_len += len;
+}
+
+int midi_writer_open(struct MidiWriter* writer, FILE* f, uint16_t format, uint16_t tracks, uint16_t division){
+	writer->f = f;
+	writer->failed = 0;
+	writer->in_track = 0;
+	writer->track_len = 0;
+	writer->spill = NULL;
+	writer->spill_len = 0;
+	writer->spill_file = NULL;
+	writer->flags = 0;
+	writer->running_status = 0;
+
+	//pipes and terminals fail to report a position
+	writer->length_pos = ftell(f);
+	writer->seekable = writer->length_pos >= 0 && !fseek(f, writer->length_pos, SEEK_SET);
+	if(!writer->seekable){
+		writer->spill = malloc(sizeof(uint8_t) * WRITER_SPILL_LEN);
+	}
+
+	fwrite("MThd", sizeof(uint8_t), TYPE_LEN, f);
+	write_uint32_t(HEADER_LEN, f);
+	write_uint16_t(format, f);
+	write_uint16_t(tracks, f);
+	write_uint16_t(division, f);
+	if(ferror(f)){
+		free(writer->spill);
+		writer->spill = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int midi_writer_begin_track(struct MidiWriter* writer){
+	if(writer->in_track){
+		writer->failed = 1;
+	}
+	if(writer->failed){
+		return -1;
+	}
+	writer->in_track = 1;
+	writer->track_len = 0;
+	writer->running_status = 0;
+	if(writer->seekable){
+		writer_put(writer, (const uint8_t*) "MTrk", TYPE_LEN);
+		writer->length_pos = ftell(writer->f);
+		//patched in by midi_writer_end_track
+		write_uint32_t(0, writer->f);
+	}
+	return writer->failed ? -1 : 0;
+}
+
+int midi_writer_event(struct MidiWriter* writer, uint32_t delta_time, const uint8_t* event, size_t event_len){
+	if(!writer->in_track){
+		writer->failed = 1;
+	}
+	if(writer->failed){
+		return -1;
+	}
+	uint8_t scratch[3];
+	event = midi_event_encoding(event, event_len, writer->flags, &writer->running_status, scratch, &event_len);
+	uint8_t time[VARLEN_MAX_LEN];
+	size_t time_size = varlen_encode(delta_time, time);
+	if(writer->seekable){
+		writer_put(writer, time, time_size);
+		writer_put(writer, event, event_len);
+	} else {
+		writer_spill(writer, time, time_size);
+		writer_spill(writer, event, event_len);
+	}
+	writer->track_len += time_size + event_len;
+	return writer->failed ? -1 : 0;
+}
+
+int midi_writer_end_track(struct MidiWriter* writer){
+	if(!writer->in_track){
+		writer->failed = 1;
+	}
+	if(writer->failed){
+		return -1;
+	}
+	writer->in_track = 0;
+	if(writer->seekable){
+		long end = ftell(writer->f);
+		if(end < 0 || fseek(writer->f, writer->length_pos, SEEK_SET)){
+			writer->failed = 1;
+			return -1;
+		}
+		write_uint32_t(writer->track_len, writer->f);
+		if(fseek(writer->f, end, SEEK_SET)){
+			writer->failed = 1;
+		}
+		return writer->failed ? -1 : 0;
+	}
+
+	writer_put(writer, (const uint8_t*) "MTrk", TYPE_LEN);
+	write_uint32_t(writer->track_len, writer->f);
+	if(writer->spill_file){
+		//move what is left into the temporary file, then copy all of it out
+		if(fwrite(writer->spill, sizeof(uint8_t), writer->spill_len, writer->spill_file) != writer->spill_len){
+			writer->failed = 1;
+		}
+		rewind(writer->spill_file);
+		size_t read;
+		while((read = fread(writer->spill, sizeof(uint8_t), WRITER_SPILL_LEN, writer->spill_file))){
+			writer_put(writer, writer->spill, read);
+		}
+		fclose(writer->spill_file);
+		writer->spill_file = NULL;
+	} else {
+		writer_put(writer, writer->spill, writer->spill_len);
+	}
+	writer->spill_len = 0;
+	return writer->failed ? -1 : 0;
+}
+
+int midi_writer_close(struct MidiWriter* writer){
+	if(writer->in_track || fflush(writer->f) || ferror(writer->f)){
+		writer->failed = 1;
+	}
+	free(writer->spill);
+	writer->spill = NULL;
+	if(writer->spill_file){
+		fclose(writer->spill_file);
+		writer->spill_file = NULL;
+	}
+	return writer->failed ? -1 : 0;
+}
@@ -0,0 +1,136 @@
+#ifndef MIDI_STREAM_H
+#define MIDI_STREAM_H
+
+#include "midi.h"
+
+#define READER_BUFFER_LEN 65536
+#define WRITER_SPILL_LEN 65536
+
+/*
+ * A pull style reader which walks the events of a MIDI file without building a `Midi`.
+ *
+ * When reading a `FILE` only a window of the file is held in memory, so the memory used does not grow with the
+ * size of the file (only with the size of the largest single event). The `FILE` does not need to be seekable.
+ * When reading a buffer nothing is copied at all.
+ *
+ * The header is available in `format`, `tracks` and `division` once the reader is opened.
+ */
+struct MidiReader {
+	FILE* f;
+	uint8_t* buffer;
+	size_t buffer_capacity;
+
+	// the bytes which have been read but not consumed are window[window_pos] .. window[window_len - 1]
+	const uint8_t* window;
+	size_t window_len;
+	size_t window_pos;
+
+	uint16_t format;
+	uint16_t tracks;
+	uint16_t division;
+
+	// index of the track currently being read, and how many of its bytes are left
+	int32_t track;
+	uint32_t track_remaining;
+
+	// events using running status are yielded from here with their status byte filled in
+	uint8_t running_status;
+	uint8_t status_event[3];
+};
+
+/*
+ * An event yielded by the reader.
+ *
+ * `event` points into the reader, and is only valid until the next call to `midi_reader_next_event`.
+ * Events which use running status in the file are yielded with their status byte filled in.
+ */
+struct MidiReaderEvent {
+	uint16_t track;
+	uint32_t delta_time;
+
+	const uint8_t* event;
+	size_t event_len;
+};
+
+/*
+ * Opens a reader on an opened `FILE` and reads the header.
+ *
+ * Returns 0 on success and -1 if the file does not start with a valid header, in which case nothing needs to be closed
+ */
+int midi_reader_open_file(struct MidiReader* reader, FILE* f);
+/*
+ * Opens a reader on a MIDI file held in memory and reads the header.
+ *
+ * `data` must stay valid until the reader is closed. Returns 0 on success and -1 if the header is invalid
+ */
+int midi_reader_open_buffer(struct MidiReader* reader, const uint8_t* data, size_t size);
+/*
+ * Reads the next event of the file into `event`, moving on through the tracks in order.
+ * Chunks which are not tracks are skipped.
+ *
+ * Returns 1 when an event was read, 0 at the end of the last track and -1 if the file is malformed or truncated
+ */
+int midi_reader_next_event(struct MidiReader* reader, struct MidiReaderEvent* event);
+/*
+ * Frees the memory held by the reader.
+ *
+ * This does not close the `FILE` or free the reader itself
+ */
+void midi_reader_close(struct MidiReader* reader);
+
+/*
+ * A writer which emits a MIDI file as its events are produced, without holding a `Midi` in memory.
+ *
+ * Track lengths are written once each track ends. On a seekable `FILE` the length is patched in by seeking back.
+ * Otherwise (e.g. a pipe) the track is held in a buffer of WRITER_SPILL_LEN bytes which spills into a temporary file 
+ * once full, so the memory used does not grow with the size of the track either way.
+ *
+ * The functions below return 0 on success and -1 on failure. 
+ * Once a write fails every later call fails too, so errors may be checked only at `midi_writer_close`
+ */
+struct MidiWriter {
+	FILE* f;
+	int seekable;
+	int failed;
+
+	int in_track;
+	uint32_t track_len;
+	// where the length of the current track goes when seeking back to it
+	long length_pos;
+
+	uint8_t* spill;
+	size_t spill_len;
+	FILE* spill_file;
+
+	// WRITE_ flags to compact the events with, these may be set any time after opening
+	unsigned flags;
+	uint8_t running_status;
+};
+
+/*
+ * Opens a writer on an opened `FILE` and writes the header.
+ *
+ * `tracks` must be the number of tracks which will be written.
+ * Returns 0 on success and -1 if the header could not be written, in which case nothing needs to be closed
+ */
+int midi_writer_open(struct MidiWriter* writer, FILE* f, uint16_t format, uint16_t tracks, uint16_t division);
+/*
+ * Starts a new track. The previous track must have been ended
+ */
+int midi_writer_begin_track(struct MidiWriter* writer);
+/*
+ * Writes a single event into the current track
+ */
+int midi_writer_event(struct MidiWriter* writer, uint32_t delta_time, const uint8_t* event, size_t event_len);
+/*
+ * Ends the current track, writing out its length (and its events if they were held back)
+ */
+int midi_writer_end_track(struct MidiWriter* writer);
+/*
+ * Frees the memory held by the writer and flushes the `FILE`.
+ *
+ * This does not close the `FILE`. Returns 0 if everything was written and -1 if any write failed along the way
+ */
+int midi_writer_close(struct MidiWriter* writer);
+
+#endif /* MIDI_STREAM_H */
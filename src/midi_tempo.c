@@ -0,0 +1,193 @@
+#include "midi_tempo.h"
+#include "midi_constants.h"
+
+static void tempo_map_add(struct MidiTempoMap* map, size_t* capacity, uint64_t tick, uint32_t rate){
+	struct MidiTempoSegment* last = &map->segments[map->segment_count - 1];
+	if(tick == last->tick){
+		//a later change on the same tick replaces the earlier one
+		last->rate = rate;
+		return;
+	}
+	if(map->segment_count == (*capacity)){
+		(*capacity) *= 2;
+		map->segments = realloc(map->segments, sizeof(struct MidiTempoSegment) * (*capacity));
+		last = &map->segments[map->segment_count - 1];
+	}
+	struct MidiTempoSegment* segment = &map->segments[map->segment_count++];
+	segment->tick = tick;
+	segment->scaled = last->scaled + (tick - last->tick) * last->rate;
+	segment->rate = rate;
+}
+
+/*
+ * Builds the map from the set tempo events of `track`, which may be NULL for a Midi without tracks
+ */
+static int build_tempo_map(struct MidiTempoMap* map, struct Midi* midi, struct MidiTrackChunk* track){
+	uint16_t division = midi->header->division;
+	uint32_t rate;
+	if(division & 0x8000){
+		map->smpte = 1;
+		uint8_t fps = (uint8_t) -(int8_t) (division >> 8);
+		uint32_t ticks_per_frame = division & 0xFF;
+		if(fps == 29){
+			//30 drop frame, 30000 / 1001 frames per second
+			rate = 1001000;
+			map->divisor = 30 * ticks_per_frame;
+		} else {
+			rate = 1000000;
+			map->divisor = fps * ticks_per_frame;
+		}
+	} else {
+		map->smpte = 0;
+		rate = DEFAULT_TEMPO;
+		map->divisor = division;
+	}
+	if(!map->divisor){
+		return -1;
+	}
+
+	size_t capacity = 4;
+	map->segments = malloc(sizeof(struct MidiTempoSegment) * capacity);
+	map->segments[0].tick = 0;
+	map->segments[0].scaled = 0;
+	map->segments[0].rate = rate;
+	map->segment_count = 1;
+	if(map->smpte || !track){
+		return 0;
+	}
+	const uint64_t* ticks = track_ticks(track);
+	for(size_t i = 0; i < track->event_count; ++i){
+		const struct MidiEvent* e = track->events[i];
+		const uint8_t* data = midi_event_data(e);
+		if(e->event_len < 6 || data[0] != 0xFF || data[1] != META_SET_TEMPO || data[2] != 3){
+			continue;
+		}
+		uint32_t tempo = ((uint32_t) data[3] << 16) | ((uint32_t) data[4] << 8) | data[5];
+		if(tempo){
+			tempo_map_add(map, &capacity, ticks[i], tempo);
+		}
+	}
+	return 0;
+}
+
+int new_tempo_map(struct MidiTempoMap* map, struct Midi* midi){
+	map->segments = NULL;
+	map->segment_count = 0;
+	//each track of a format 2 file has a tempo map of its own
+	if(!midi->header || midi->header->format == 2){
+		return -1;
+	}
+	return build_tempo_map(map, midi, midi_track(midi, 0));
+}
+
+int new_tempo_map_track(struct MidiTempoMap* map, struct Midi* midi, uint32_t index){
+	map->segments = NULL;
+	map->segment_count = 0;
+	struct MidiTrackChunk* track = midi_track(midi, index);
+	if(!midi->header || !track){
+		return -1;
+	}
+	return build_tempo_map(map, midi, track);
+}
+
+void free_tempo_map(struct MidiTempoMap* map){
+	free(map->segments);
+	map->segments = NULL;
+	map->segment_count = 0;
+}
+
+/*
+ * The index of the last segment starting at or before `tick`
+ */
+static size_t segment_for_tick(const struct MidiTempoMap* map, uint64_t tick){
+	size_t low = 0;
+	size_t high = map->segment_count;
+	while(high - low > 1){
+		size_t mid = low + (high - low) / 2;
+		if(map->segments[mid].tick <= tick){
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/*
+ * The index of the last segment starting at or before the scaled time `scaled`
+ */
+static size_t segment_for_scaled(const struct MidiTempoMap* map, uint64_t scaled){
+	size_t low = 0;
+	size_t high = map->segment_count;
+	while(high - low > 1){
+		size_t mid = low + (high - low) / 2;
+		if(map->segments[mid].scaled <= scaled){
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+static uint64_t segment_tick_to_us(const struct MidiTempoMap* map, const struct MidiTempoSegment* segment, uint64_t tick){
+	return (segment->scaled + (tick - segment->tick) * segment->rate) / map->divisor;
+}
+
+static uint64_t segment_scaled_to_tick(const struct MidiTempoSegment* segment, uint64_t scaled){
+	return segment->tick + (scaled - segment->scaled) / segment->rate;
+}
+
+uint64_t tempo_map_tick_to_us(const struct MidiTempoMap* map, uint64_t tick){
+	return segment_tick_to_us(map, &map->segments[segment_for_tick(map, tick)], tick);
+}
+
+/*
+ * The latest scaled time which is still rounded down to `us`
+ */
+static uint64_t us_to_scaled(const struct MidiTempoMap* map, uint64_t us){
+	return us * map->divisor + map->divisor - 1;
+}
+
+uint64_t tempo_map_us_to_tick(const struct MidiTempoMap* map, uint64_t us){
+	uint64_t scaled = us_to_scaled(map, us);
+	return segment_scaled_to_tick(&map->segments[segment_for_scaled(map, scaled)], scaled);
+}
+
+void tempo_map_ticks_to_us(const struct MidiTempoMap* map, const uint64_t* ticks, uint64_t* out, size_t count){
+	const struct MidiTempoSegment* segments = map->segments;
+	size_t last = map->segment_count - 1;
+	size_t s = 0;
+	for(size_t i = 0; i < count; ++i){
+		uint64_t tick = ticks[i];
+		if(tick < segments[s].tick || (s < last && tick >= segments[s + 1].tick)){
+			if(s < last && tick >= segments[s + 1].tick && (s + 1 == last || tick < segments[s + 2].tick)){
+				s++;
+			} else {
+				s = segment_for_tick(map, tick);
+			}
+		}
+		out[i] = segment_tick_to_us(map, &segments[s], tick);
+	}
+}
+
+void tempo_map_us_to_ticks(const struct MidiTempoMap* map, const uint64_t* us, uint64_t* out, size_t count){
+	const struct MidiTempoSegment* segments = map->segments;
+	size_t last = map->segment_count - 1;
+	size_t s = 0;
+	for(size_t i = 0; i < count; ++i){
+		uint64_t scaled = us_to_scaled(map, us[i]);
+		if(scaled < segments[s].scaled || (s < last && scaled >= segments[s + 1].scaled)){
+			if(s < last && scaled >= segments[s + 1].scaled && (s + 1 == last || scaled < segments[s + 2].scaled)){
+				s++;
+			} else {
+				s = segment_for_scaled(map, scaled);
+			}
+		}
+		out[i] = segment_scaled_to_tick(&segments[s], scaled);
+	}
+}
+
+void tempo_map_track_to_us(const struct MidiTempoMap* map, struct MidiTrackChunk* track, uint64_t* out){
+	tempo_map_ticks_to_us(map, track_ticks(track), out, track->event_count);
+}
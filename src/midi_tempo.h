@@ -0,0 +1,85 @@
+#ifndef MIDI_TEMPO_H
+#define MIDI_TEMPO_H
+
+#include "midi.h"
+
+// the tempo before the first set tempo event, 120 beats per minute
+#define DEFAULT_TEMPO 500000
+
+/*
+ * A stretch of the file over which the tempo does not change.
+ *
+ * From `tick` on every tick lasts `rate` / divisor µs, and `scaled` is the time at `tick` in µs * divisor.
+ * Keeping the time scaled means no rounding error builds up across tempo changes
+ */
+struct MidiTempoSegment {
+	uint64_t tick;
+	uint64_t scaled;
+	uint32_t rate;
+};
+
+/*
+ * Converts between ticks and wall clock time for a `Midi`.
+ *
+ * With a ticks per quarter note division there is a segment per tempo change, and rate is the tempo in µs per
+ * quarter note with divisor the ticks per quarter note.
+ * With an SMPTE division (the high bit set, frames per second in the high byte as a negative number and ticks per
+ * frame in the low byte) ticks are a fixed length and tempo changes are ignored, so there is a single segment.
+ * -29 frames per second is 30 drop frame, which runs at 29.97 frames per second.
+ */
+struct MidiTempoMap {
+	struct MidiTempoSegment* segments;
+	size_t segment_count;
+
+	uint32_t divisor;
+	int smpte;
+};
+
+/*
+ * Builds the tempo map of `midi` from the set tempo events of its first track.
+ *
+ * In format 0 and 1 files the tempo changes are in the first track, which for format 1 is the conductor track that
+ * sets the tempo of every other track. The tracks of a format 2 file are independent sequences with tempos of their
+ * own, so those are mapped one track at a time with `new_tempo_map_track` instead.
+ * When several tempo changes fall on the same tick the last one wins.
+ * Returns 0 on success and -1 if the `Midi` has no header, is format 2 or its division is 0
+ */
+int new_tempo_map(struct MidiTempoMap* map, struct Midi* midi);
+/*
+ * Builds the tempo map of the `index`th track of `midi` from that track's set tempo events alone, e.g. for one
+ * sequence of a format 2 file.
+ *
+ * Returns 0 on success and -1 if the `Midi` has no header or no such track, or its division is 0
+ */
+int new_tempo_map_track(struct MidiTempoMap* map, struct Midi* midi, uint32_t index);
+/*
+ * Frees the segments of the tempo map.
+ *
+ * This does not free the map itself
+ */
+void free_tempo_map(struct MidiTempoMap* map);
+
+/*
+ * Converts an absolute tick to µs from the start of the file, and back.
+ *
+ * Both are a binary search over the segments, so O(log n) in the number of tempo changes.
+ * Times are rounded down to the µs, and the tick of a time is the last tick at or before it, so converting a tick
+ * to µs and back gives the same tick
+ */
+uint64_t tempo_map_tick_to_us(const struct MidiTempoMap* map, uint64_t tick);
+uint64_t tempo_map_us_to_tick(const struct MidiTempoMap* map, uint64_t us);
+
+/*
+ * Converts `count` ticks to µs, or µs to ticks, into `out` (which may be the input).
+ *
+ * The segment of the previous value is checked first, so sorted input (e.g. the ticks of a track) costs O(1) per
+ * value and only falls back to a binary search when it jumps backwards or past the next segment
+ */
+void tempo_map_ticks_to_us(const struct MidiTempoMap* map, const uint64_t* ticks, uint64_t* out, size_t count);
+void tempo_map_us_to_ticks(const struct MidiTempoMap* map, const uint64_t* us, uint64_t* out, size_t count);
+/*
+ * Writes the time in µs of every event of the track into `out`, which must hold `event_count` values
+ */
+void tempo_map_track_to_us(const struct MidiTempoMap* map, struct MidiTrackChunk* track, uint64_t* out);
+
+#endif /* MIDI_TEMPO_H */
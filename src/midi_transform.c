@@ -0,0 +1,560 @@
+#include "midi_transform.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRANSFORM_X86
+#include <immintrin.h>
+// the kernels are built for their instruction sets whatever the rest of the library is built for, and only run
+// once the CPU is known to support them
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static int active_isa = -1;
+
+static int best_isa(void){
+#ifdef TRANSFORM_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		return TRANSFORM_ISA_AVX2;
+	}
+	if(__builtin_cpu_supports("sse2")){
+		return TRANSFORM_ISA_SSE2;
+	}
+#endif
+	return TRANSFORM_ISA_SCALAR;
+}
+
+int transform_isa(void){
+	int isa = __atomic_load_n(&active_isa, __ATOMIC_RELAXED);
+	if(isa < 0){
+		isa = best_isa();
+		__atomic_store_n(&active_isa, isa, __ATOMIC_RELAXED);
+	}
+	return isa;
+}
+
+int transform_set_isa(int isa){
+	int best = best_isa();
+	if(isa < TRANSFORM_ISA_SCALAR || isa > best){
+		isa = best;
+	}
+	__atomic_store_n(&active_isa, isa, __ATOMIC_RELAXED);
+	return isa;
+}
+
+void new_event_columns(struct MidiEventColumns* columns){
+	columns->count = 0;
+	columns->capacity = 0;
+
+	columns->status = NULL;
+	columns->data1 = NULL;
+	columns->data2 = NULL;
+	columns->keep = NULL;
+}
+
+void free_event_columns(struct MidiEventColumns* columns){
+	free(columns->status);
+	columns->status = NULL;
+	free(columns->data1);
+	columns->data1 = NULL;
+	free(columns->data2);
+	columns->data2 = NULL;
+	free(columns->keep);
+	columns->keep = NULL;
+
+	columns->count = 0;
+	columns->capacity = 0;
+}
+
+static void columns_reserve(struct MidiEventColumns* columns, size_t count){
+	if(count > columns->capacity){
+		columns->status = realloc(columns->status, count);
+		columns->data1 = realloc(columns->data1, count);
+		columns->data2 = realloc(columns->data2, count);
+		columns->keep = realloc(columns->keep, count);
+		columns->capacity = count;
+	}
+	columns->count = count;
+}
+
+static void columns_gather(struct MidiEventColumns* columns, size_t i, const uint8_t* data, size_t len){
+	uint8_t status = len ? data[0] : 0;
+	columns->status[i] = status;
+	//only voice events and the type of meta events are of any use to the kernels
+	columns->data1[i] = (len > 1 && (status < 0xF0 || status == 0xFF)) ? data[1] : 0;
+	columns->data2[i] = (len > 2 && status < 0xF0) ? data[2] : 0;
+	columns->keep[i] = 1;
+}
+
+void event_columns_from_track(struct MidiEventColumns* columns, const struct MidiTrackChunk* track){
+	columns_reserve(columns, track->event_count);
+	for(size_t i = 0; i < track->event_count; ++i){
+		struct MidiEvent* e = track->events[i];
+		columns_gather(columns, i, midi_event_data(e), e->event_len);
+	}
+}
+
+void event_columns_from_packed(struct MidiEventColumns* columns, const struct MidiPackedTrack* track){
+	columns_reserve(columns, track->event_count);
+	for(size_t i = 0; i < track->event_count; ++i){
+		columns_gather(columns, i, track->pool + track->offset[i], track->length[i]);
+	}
+}
+
+/*
+ * Fills in the bytes of voice event `i` from the columns. Returns 1 if that changes them from `data`
+ */
+static int columns_scatter(const struct MidiEventColumns* columns, size_t i, const uint8_t* data, size_t len, uint8_t bytes[3]){
+	uint8_t status = columns->status[i];
+	if(status < 0x80 || status >= 0xF0 || len > 3){
+		return 0;
+	}
+	bytes[0] = status;
+	bytes[1] = columns->data1[i];
+	bytes[2] = columns->data2[i];
+	return memcmp(data, bytes, len) != 0;
+}
+
+static size_t first_dropped(const struct MidiEventColumns* columns){
+	for(size_t i = 0; i < columns->count; ++i){
+		if(!columns->keep[i]){
+			return i;
+		}
+	}
+	return columns->count;
+}
+
+void event_columns_to_track(const struct MidiEventColumns* columns, struct MidiTrackChunk* track){
+	assert(columns->count == track->event_count);
+	assert(__atomic_load_n(&track->refs, __ATOMIC_ACQUIRE) == 1);
+	int changed = 0;
+	for(size_t i = 0; i < track->event_count; ++i){
+		struct MidiEvent* e = track->events[i];
+		uint8_t bytes[3];
+		if(columns_scatter(columns, i, midi_event_data(e), e->event_len, bytes)){
+			//voice events always fit inline, so borrowed bytes are replaced rather than copied first
+			uint32_t delta_time = e->delta_time;
+			size_t len = e->event_len;
+			free_midi_event(e);
+			new_midi_event(e, delta_time, bytes, len);
+			changed = 1;
+		}
+	}
+
+	size_t from = first_dropped(columns);
+	if(from < track->event_count){
+		//the events left in the block stay at the front, so it can still be told apart from the rest
+		size_t block_kept = from < track->block_count ? from : track->block_count;
+		size_t kept = from;
+		uint32_t carry = 0;
+		for(size_t i = from; i < track->event_count; ++i){
+			struct MidiEvent* e = track->events[i];
+			if(columns->keep[i]){
+				e->delta_time += carry;
+				carry = 0;
+				track->events[kept++] = e;
+				if(i < track->block_count){
+					block_kept++;
+				}
+			} else {
+				carry += e->delta_time;
+				free_midi_event(e);
+				if(!track->arena && i >= track->block_count){
+					free(e);
+				}
+			}
+		}
+		track->event_count = kept;
+		track->block_count = block_kept;
+		track_invalidate_ticks(track, from);
+		changed = 1;
+	}
+	if(changed){
+		track_mark_dirty(track);
+	}
+}
+
+void event_columns_to_packed(const struct MidiEventColumns* columns, struct MidiPackedTrack* track){
+	assert(columns->count == track->event_count);
+	for(size_t i = 0; i < track->event_count; ++i){
+		uint8_t bytes[3];
+		if(columns_scatter(columns, i, track->pool + track->offset[i], track->length[i], bytes)){
+			memcpy(track->pool + track->offset[i], bytes, track->length[i]);
+		}
+	}
+
+	size_t from = first_dropped(columns);
+	if(from == track->event_count){
+		return;
+	}
+	//the pool holds the events back to back, so it is compacted along with the columns
+	size_t pos = track->offset[from];
+	size_t kept = from;
+	uint32_t carry = 0;
+	for(size_t i = from; i < track->event_count; ++i){
+		if(!columns->keep[i]){
+			carry += track->delta_time[i];
+			continue;
+		}
+		memmove(track->pool + pos, track->pool + track->offset[i], track->length[i]);
+		track->delta_time[kept] = track->delta_time[i] + carry;
+		track->offset[kept] = (uint32_t) pos;
+		track->length[kept] = track->length[i];
+		pos += track->length[i];
+		carry = 0;
+		kept++;
+	}
+	track->event_count = kept;
+	track->pool_len = pos;
+}
+
+/*
+ * Builds a lookup table of 0xFF for the channels in the mask and 0 for the rest
+ */
+static void channel_table(uint16_t channels, uint8_t table[16]){
+	for(int c = 0; c < 16; ++c){
+		table[c] = (channels >> c) & 1 ? 0xFF : 0;
+	}
+}
+
+static int clamp(int value, int low, int high){
+	return value < low ? low : value > high ? high : value;
+}
+
+#ifdef TRANSFORM_X86
+/*
+ * Looks up 16 indices of 0 .. 15 in a 16 byte table. SSE2 has no byte shuffle, so the indices are compared against
+ * each nonzero entry in turn
+ */
+TARGET_SSE2 static __m128i sse2_lookup16(__m128i index, const uint8_t table[16]){
+	__m128i result = _mm_setzero_si128();
+	for(int k = 0; k < 16; ++k){
+		if(table[k]){
+			__m128i hit = _mm_cmpeq_epi8(index, _mm_set1_epi8((char) k));
+			result = _mm_or_si128(result, _mm_and_si128(hit, _mm_set1_epi8((char) table[k])));
+		}
+	}
+	return result;
+}
+
+TARGET_SSE2 static __m128i sse2_high_nibble(__m128i bytes){
+	return _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0F));
+}
+
+TARGET_SSE2 static __m128i sse2_select(__m128i mask, __m128i a, __m128i b){
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+TARGET_AVX2 static __m256i avx2_lookup16(__m256i index, const uint8_t table[16]){
+	__m256i t = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) table));
+	return _mm256_shuffle_epi8(t, index);
+}
+
+TARGET_AVX2 static __m256i avx2_high_nibble(__m256i bytes){
+	return _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0F));
+}
+
+TARGET_AVX2 static __m256i avx2_select(__m256i mask, __m256i a, __m256i b){
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+TARGET_SSE2 static size_t transpose_sse2(struct MidiEventColumns* c, int semitones, const uint8_t table[16]){
+	const __m128i low = _mm_set1_epi8(0x0F);
+	const __m128i shift = _mm_set1_epi8((char) semitones);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 16 <= c->count; i += 16){
+		__m128i s = _mm_loadu_si128((const __m128i*) (c->status + i));
+		__m128i d = _mm_loadu_si128((const __m128i*) (c->data1 + i));
+		__m128i hi = sse2_high_nibble(s);
+		__m128i note = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(8)), _mm_cmpeq_epi8(hi, _mm_set1_epi8(9))),
+				_mm_cmpeq_epi8(hi, _mm_set1_epi8(0xA)));
+		__m128i selected = _mm_and_si128(note, sse2_lookup16(_mm_and_si128(s, low), table));
+		//notes are at most 127, so saturating signed bytes clamp the top and only negatives need clearing
+		__m128i moved = _mm_adds_epi8(d, shift);
+		moved = _mm_andnot_si128(_mm_cmplt_epi8(moved, zero), moved);
+		_mm_storeu_si128((__m128i*) (c->data1 + i), sse2_select(selected, moved, d));
+	}
+	return i;
+}
+
+TARGET_AVX2 static size_t transpose_avx2(struct MidiEventColumns* c, int semitones, const uint8_t table[16]){
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	const __m256i shift = _mm256_set1_epi8((char) semitones);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for(; i + 32 <= c->count; i += 32){
+		__m256i s = _mm256_loadu_si256((const __m256i*) (c->status + i));
+		__m256i d = _mm256_loadu_si256((const __m256i*) (c->data1 + i));
+		__m256i hi = avx2_high_nibble(s);
+		__m256i note = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(hi, _mm256_set1_epi8(8)), _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(9))),
+				_mm256_cmpeq_epi8(hi, _mm256_set1_epi8(0xA)));
+		__m256i selected = _mm256_and_si256(note, avx2_lookup16(_mm256_and_si256(s, low), table));
+		__m256i moved = _mm256_adds_epi8(d, shift);
+		moved = _mm256_andnot_si256(_mm256_cmpgt_epi8(zero, moved), moved);
+		_mm256_storeu_si256((__m256i*) (c->data1 + i), avx2_select(selected, moved, d));
+	}
+	return i;
+}
+
+TARGET_SSE2 static __m128i sse2_scale16(__m128i v, __m128i scale, __m128i offset){
+	__m128i scaled = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(v, scale), _mm_set1_epi16(64)), 7);
+	scaled = _mm_adds_epi16(scaled, offset);
+	return _mm_max_epi16(_mm_min_epi16(scaled, _mm_set1_epi16(127)), _mm_set1_epi16(1));
+}
+
+TARGET_SSE2 static size_t velocity_scale_sse2(struct MidiEventColumns* c, unsigned scale, int offset){
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i scale16 = _mm_set1_epi16((short) scale);
+	const __m128i offset16 = _mm_set1_epi16((short) offset);
+	size_t i = 0;
+	for(; i + 16 <= c->count; i += 16){
+		__m128i s = _mm_loadu_si128((const __m128i*) (c->status + i));
+		__m128i d = _mm_loadu_si128((const __m128i*) (c->data2 + i));
+		__m128i v = _mm_and_si128(d, _mm_set1_epi8(0x7F));
+		__m128i selected = _mm_andnot_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(sse2_high_nibble(s), _mm_set1_epi8(9)));
+		//widened to 16 bits for the multiply
+		__m128i lo = sse2_scale16(_mm_unpacklo_epi8(v, zero), scale16, offset16);
+		__m128i hi = sse2_scale16(_mm_unpackhi_epi8(v, zero), scale16, offset16);
+		_mm_storeu_si128((__m128i*) (c->data2 + i), sse2_select(selected, _mm_packus_epi16(lo, hi), d));
+	}
+	return i;
+}
+
+TARGET_AVX2 static __m256i avx2_scale16(__m256i v, __m256i scale, __m256i offset){
+	__m256i scaled = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(v, scale), _mm256_set1_epi16(64)), 7);
+	scaled = _mm256_adds_epi16(scaled, offset);
+	return _mm256_max_epi16(_mm256_min_epi16(scaled, _mm256_set1_epi16(127)), _mm256_set1_epi16(1));
+}
+
+TARGET_AVX2 static size_t velocity_scale_avx2(struct MidiEventColumns* c, unsigned scale, int offset){
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i scale16 = _mm256_set1_epi16((short) scale);
+	const __m256i offset16 = _mm256_set1_epi16((short) offset);
+	size_t i = 0;
+	for(; i + 32 <= c->count; i += 32){
+		__m256i s = _mm256_loadu_si256((const __m256i*) (c->status + i));
+		__m256i d = _mm256_loadu_si256((const __m256i*) (c->data2 + i));
+		__m256i v = _mm256_and_si256(d, _mm256_set1_epi8(0x7F));
+		__m256i selected = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(avx2_high_nibble(s), _mm256_set1_epi8(9)));
+		//unpacking and packing both work within 128 bit lanes, so the bytes come back in order
+		__m256i lo = avx2_scale16(_mm256_unpacklo_epi8(v, zero), scale16, offset16);
+		__m256i hi = avx2_scale16(_mm256_unpackhi_epi8(v, zero), scale16, offset16);
+		_mm256_storeu_si256((__m256i*) (c->data2 + i), avx2_select(selected, _mm256_packus_epi16(lo, hi), d));
+	}
+	return i;
+}
+
+TARGET_AVX2 static size_t velocity_curve_avx2(struct MidiEventColumns* c, const uint8_t curve[128]){
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	size_t i = 0;
+	for(; i + 32 <= c->count; i += 32){
+		__m256i s = _mm256_loadu_si256((const __m256i*) (c->status + i));
+		__m256i d = _mm256_loadu_si256((const __m256i*) (c->data2 + i));
+		__m256i v = _mm256_and_si256(d, _mm256_set1_epi8(0x7F));
+		__m256i selected = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(avx2_high_nibble(s), _mm256_set1_epi8(9)));
+		//the curve is looked up 16 entries at a time, keeping the entries from the right eighth of it
+		__m256i index = _mm256_and_si256(v, low);
+		__m256i part = avx2_high_nibble(v);
+		__m256i mapped = zero;
+		for(int k = 0; k < 8; ++k){
+			__m256i in_part = _mm256_cmpeq_epi8(part, _mm256_set1_epi8((char) k));
+			mapped = _mm256_or_si256(mapped, _mm256_and_si256(in_part, avx2_lookup16(index, curve + 16 * k)));
+		}
+		//clamped so the curve cannot turn a note on into a note off, or write an invalid data byte
+		mapped = _mm256_max_epu8(_mm256_min_epu8(mapped, _mm256_set1_epi8(127)), _mm256_set1_epi8(1));
+		_mm256_storeu_si256((__m256i*) (c->data2 + i), avx2_select(selected, mapped, d));
+	}
+	return i;
+}
+
+TARGET_SSE2 static size_t channel_remap_sse2(struct MidiEventColumns* c, const uint8_t map[16]){
+	const __m128i low = _mm_set1_epi8(0x0F);
+	size_t i = 0;
+	for(; i + 16 <= c->count; i += 16){
+		__m128i s = _mm_loadu_si128((const __m128i*) (c->status + i));
+		__m128i hi = sse2_high_nibble(s);
+		__m128i voice = _mm_andnot_si128(_mm_cmpeq_epi8(hi, low), _mm_cmpgt_epi8(hi, _mm_set1_epi8(7)));
+		__m128i moved = _mm_or_si128(_mm_andnot_si128(low, s), sse2_lookup16(_mm_and_si128(s, low), map));
+		_mm_storeu_si128((__m128i*) (c->status + i), sse2_select(voice, moved, s));
+	}
+	return i;
+}
+
+TARGET_AVX2 static size_t channel_remap_avx2(struct MidiEventColumns* c, const uint8_t map[16]){
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	size_t i = 0;
+	for(; i + 32 <= c->count; i += 32){
+		__m256i s = _mm256_loadu_si256((const __m256i*) (c->status + i));
+		__m256i hi = avx2_high_nibble(s);
+		__m256i voice = _mm256_andnot_si256(_mm256_cmpeq_epi8(hi, low), _mm256_cmpgt_epi8(hi, _mm256_set1_epi8(7)));
+		__m256i moved = _mm256_or_si256(_mm256_andnot_si256(low, s), avx2_lookup16(_mm256_and_si256(s, low), map));
+		_mm256_storeu_si256((__m256i*) (c->status + i), avx2_select(voice, moved, s));
+	}
+	return i;
+}
+
+TARGET_SSE2 static size_t filter_sse2(struct MidiEventColumns* c, const uint8_t table[16], uint8_t meta, uint8_t sysex){
+	const __m128i one = _mm_set1_epi8(1);
+	size_t i = 0;
+	for(; i + 16 <= c->count; i += 16){
+		__m128i s = _mm_loadu_si128((const __m128i*) (c->status + i));
+		__m128i d = _mm_loadu_si128((const __m128i*) (c->data1 + i));
+		__m128i hi = sse2_high_nibble(s);
+		__m128i is_meta = _mm_cmpeq_epi8(s, _mm_set1_epi8((char) 0xFF));
+		__m128i is_sysex = _mm_andnot_si128(is_meta, _mm_cmpeq_epi8(hi, _mm_set1_epi8(0x0F)));
+		__m128i end = _mm_and_si128(is_meta, _mm_cmpeq_epi8(d, _mm_set1_epi8(0x2F)));
+		__m128i kept = _mm_or_si128(sse2_lookup16(hi, table), end);
+		kept = _mm_or_si128(kept, _mm_and_si128(is_meta, _mm_set1_epi8((char) meta)));
+		kept = _mm_or_si128(kept, _mm_and_si128(is_sysex, _mm_set1_epi8((char) sysex)));
+		__m128i keep = _mm_loadu_si128((const __m128i*) (c->keep + i));
+		_mm_storeu_si128((__m128i*) (c->keep + i), _mm_and_si128(keep, _mm_and_si128(kept, one)));
+	}
+	return i;
+}
+
+TARGET_AVX2 static size_t filter_avx2(struct MidiEventColumns* c, const uint8_t table[16], uint8_t meta, uint8_t sysex){
+	const __m256i one = _mm256_set1_epi8(1);
+	size_t i = 0;
+	for(; i + 32 <= c->count; i += 32){
+		__m256i s = _mm256_loadu_si256((const __m256i*) (c->status + i));
+		__m256i d = _mm256_loadu_si256((const __m256i*) (c->data1 + i));
+		__m256i hi = avx2_high_nibble(s);
+		__m256i is_meta = _mm256_cmpeq_epi8(s, _mm256_set1_epi8((char) 0xFF));
+		__m256i is_sysex = _mm256_andnot_si256(is_meta, _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(0x0F)));
+		__m256i end = _mm256_and_si256(is_meta, _mm256_cmpeq_epi8(d, _mm256_set1_epi8(0x2F)));
+		__m256i kept = _mm256_or_si256(avx2_lookup16(hi, table), end);
+		kept = _mm256_or_si256(kept, _mm256_and_si256(is_meta, _mm256_set1_epi8((char) meta)));
+		kept = _mm256_or_si256(kept, _mm256_and_si256(is_sysex, _mm256_set1_epi8((char) sysex)));
+		__m256i keep = _mm256_loadu_si256((const __m256i*) (c->keep + i));
+		_mm256_storeu_si256((__m256i*) (c->keep + i), _mm256_and_si256(keep, _mm256_and_si256(kept, one)));
+	}
+	return i;
+}
+#endif
+
+/*
+ * Each kernel runs its vector version over as much of the columns as it can, then finishes with the scalar version
+ */
+
+void event_columns_transpose(struct MidiEventColumns* columns, int semitones, uint16_t channels){
+	semitones = clamp(semitones, -127, 127);
+	uint8_t table[16];
+	channel_table(channels, table);
+	size_t i = 0;
+#ifdef TRANSFORM_X86
+	int isa = transform_isa();
+	if(isa == TRANSFORM_ISA_AVX2){
+		i = transpose_avx2(columns, semitones, table);
+	} else if(isa == TRANSFORM_ISA_SSE2){
+		i = transpose_sse2(columns, semitones, table);
+	}
+#endif
+	for(; i < columns->count; ++i){
+		uint8_t status = columns->status[i];
+		if(((status & 0xE0) == 0x80 || (status & 0xF0) == 0xA0) && table[status & 0x0F]){
+			//out of range data bytes are treated as negative, as the vector versions do
+			columns->data1[i] = (uint8_t) clamp((int8_t) columns->data1[i] + semitones, 0, 127);
+		}
+	}
+}
+
+void event_columns_velocity_scale(struct MidiEventColumns* columns, unsigned scale, int offset){
+	if(scale > 511){
+		scale = 511;
+	}
+	offset = clamp(offset, -127, 127);
+	size_t i = 0;
+#ifdef TRANSFORM_X86
+	int isa = transform_isa();
+	if(isa == TRANSFORM_ISA_AVX2){
+		i = velocity_scale_avx2(columns, scale, offset);
+	} else if(isa == TRANSFORM_ISA_SSE2){
+		i = velocity_scale_sse2(columns, scale, offset);
+	}
+#endif
+	for(; i < columns->count; ++i){
+		uint8_t velocity = columns->data2[i] & 0x7F;
+		if((columns->status[i] & 0xF0) == 0x90 && velocity){
+			columns->data2[i] = (uint8_t) clamp((int) ((velocity * scale + 64) >> 7) + offset, 1, 127);
+		}
+	}
+}
+
+void event_columns_velocity_curve(struct MidiEventColumns* columns, const uint8_t curve[128]){
+	size_t i = 0;
+#ifdef TRANSFORM_X86
+	if(transform_isa() == TRANSFORM_ISA_AVX2){
+		i = velocity_curve_avx2(columns, curve);
+	}
+#endif
+	for(; i < columns->count; ++i){
+		uint8_t velocity = columns->data2[i] & 0x7F;
+		if((columns->status[i] & 0xF0) == 0x90 && velocity){
+			columns->data2[i] = (uint8_t) clamp(curve[velocity], 1, 127);
+		}
+	}
+}
+
+void event_columns_channel_remap(struct MidiEventColumns* columns, const uint8_t map[16]){
+	uint8_t table[16];
+	for(int c = 0; c < 16; ++c){
+		table[c] = map[c] & 0x0F;
+	}
+	size_t i = 0;
+#ifdef TRANSFORM_X86
+	int isa = transform_isa();
+	if(isa == TRANSFORM_ISA_AVX2){
+		i = channel_remap_avx2(columns, table);
+	} else if(isa == TRANSFORM_ISA_SSE2){
+		i = channel_remap_sse2(columns, table);
+	}
+#endif
+	for(; i < columns->count; ++i){
+		uint8_t status = columns->status[i];
+		if(status >= 0x80 && status < 0xF0){
+			columns->status[i] = (status & 0xF0) | table[status & 0x0F];
+		}
+	}
+}
+
+size_t event_columns_filter(struct MidiEventColumns* columns, unsigned classes){
+	//which voice events to keep by the high nibble of their status, the rest are told apart by their whole status byte
+	uint8_t table[16];
+	for(int n = 0; n < 16; ++n){
+		table[n] = (n >= 0x8 && n < 0xF && ((classes >> n) & 1)) ? 0xFF : 0;
+	}
+	uint8_t meta = (classes & CLASS_META) ? 0xFF : 0;
+	uint8_t sysex = (classes & CLASS_SYSEX) ? 0xFF : 0;
+	size_t i = 0;
+#ifdef TRANSFORM_X86
+	int isa = transform_isa();
+	if(isa == TRANSFORM_ISA_AVX2){
+		i = filter_avx2(columns, table, meta, sysex);
+	} else if(isa == TRANSFORM_ISA_SSE2){
+		i = filter_sse2(columns, table, meta, sysex);
+	}
+#endif
+	for(; i < columns->count; ++i){
+		uint8_t status = columns->status[i];
+		uint8_t kept;
+		if(status == 0xFF){
+			kept = meta || columns->data1[i] == 0x2F;
+		} else if(status >= 0xF0){
+			kept = sysex;
+		} else {
+			kept = table[status >> 4];
+		}
+		columns->keep[i] &= kept ? 1 : 0;
+	}
+
+	size_t count = 0;
+	for(i = 0; i < columns->count; ++i){
+		count += columns->keep[i];
+	}
+	return count;
+}
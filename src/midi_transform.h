@@ -0,0 +1,107 @@
+#ifndef MIDI_TRANSFORM_H
+#define MIDI_TRANSFORM_H
+
+#include "midi.h"
+#include "midi_packed.h"
+
+/*
+ * Which instructions the transform kernels use. They pick the best the CPU supports unless told otherwise
+ */
+#define TRANSFORM_ISA_SCALAR 0
+#define TRANSFORM_ISA_SSE2 1
+#define TRANSFORM_ISA_AVX2 2
+
+/*
+ * Classes of events for `event_columns_filter`, which can be combined
+ */
+#define CLASS_META 0x0001
+#define CLASS_NOTE_OFF 0x0100
+#define CLASS_NOTE_ON 0x0200
+#define CLASS_POLY_PRESSURE 0x0400
+#define CLASS_CONTROLLER 0x0800
+#define CLASS_PROGRAM 0x1000
+#define CLASS_CHANNEL_PRESSURE 0x2000
+#define CLASS_PITCH_BEND 0x4000
+#define CLASS_SYSEX 0x8000
+#define CLASS_VOICE 0x7F00
+#define CLASS_ALL 0xFF01
+
+// a channel mask selecting every channel
+#define ALL_CHANNELS 0xFFFF
+
+/*
+ * The first bytes of a track's events gathered into columns, so transforms can work on many events at once.
+ *
+ * Event `i` has the status byte status[i] followed by data1[i] and data2[i] where it has them. A meta event's type
+ * is kept in data1, and a sysex event's data is not gathered. keep[i] is cleared by `event_columns_filter` to
+ * drop the event when the columns are stored back.
+ * Gathering and storing walk the events once each, so several transforms can be applied in between.
+ */
+struct MidiEventColumns {
+	size_t count;
+	size_t capacity;
+
+	uint8_t* status;
+	uint8_t* data1;
+	uint8_t* data2;
+	uint8_t* keep;
+};
+
+void new_event_columns(struct MidiEventColumns* columns);
+void free_event_columns(struct MidiEventColumns* columns);
+
+/*
+ * Gathers the events of a track into the columns, replacing what they held
+ */
+void event_columns_from_track(struct MidiEventColumns* columns, const struct MidiTrackChunk* track);
+void event_columns_from_packed(struct MidiEventColumns* columns, const struct MidiPackedTrack* track);
+/*
+ * Stores the columns back into the track they were gathered from, which must not have changed since.
+ *
+ * Only voice events are rewritten, and the track is marked dirty if any of them changed. Dropped events are removed
+ * and freed, with their delta times carried over to the next event so the rest keep their ticks.
+ * A track shared with a clone has to be fetched with `midi_track_writable` first.
+ */
+void event_columns_to_track(const struct MidiEventColumns* columns, struct MidiTrackChunk* track);
+void event_columns_to_packed(const struct MidiEventColumns* columns, struct MidiPackedTrack* track);
+
+/*
+ * Moves the notes of note on, note off and polyphonic pressure events on the channels in `channels` (bit n for
+ * channel n) by `semitones`, clamping them to 0 .. 127
+ */
+void event_columns_transpose(struct MidiEventColumns* columns, int semitones, uint16_t channels);
+/*
+ * Scales the velocity of note ons by `scale` / 128 (rounded, `scale` is at most 511) then adds `offset`,
+ * clamping to 1 .. 127 so no note on turns into a note off. Note ons with velocity 0 are left alone
+ */
+void event_columns_velocity_scale(struct MidiEventColumns* columns, unsigned scale, int offset);
+/*
+ * Maps the velocity v of every note on to curve[v], clamped to 1 .. 127 like `event_columns_velocity_scale`.
+ * Note ons with velocity 0 are left alone.
+ *
+ * Only AVX2 has the byte shuffles to look these up in parallel, so SSE2 uses the scalar kernel
+ */
+void event_columns_velocity_curve(struct MidiEventColumns* columns, const uint8_t curve[128]);
+/*
+ * Moves every voice event on channel n to channel map[n]
+ */
+void event_columns_channel_remap(struct MidiEventColumns* columns, const uint8_t map[16]);
+/*
+ * Drops the events whose class is not in `classes` (CLASS_ flags). End of track events are always kept.
+ *
+ * Filters combine, an event dropped by an earlier filter stays dropped. Returns how many events are kept
+ */
+size_t event_columns_filter(struct MidiEventColumns* columns, unsigned classes);
+
+/*
+ * Returns the TRANSFORM_ISA_ the kernels use
+ */
+int transform_isa(void);
+/*
+ * Makes the kernels use `isa`, or the best the CPU supports if it does not support `isa`. Returns what is used.
+ *
+ * This is meant for testing and benchmarking the kernels against each other
+ */
+int transform_set_isa(int isa);
+
+#endif /* MIDI_TRANSFORM_H */
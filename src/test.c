@@ -1,8 +1,24 @@
+//for popen
+#define _POSIX_C_SOURCE 200809L
+
 #include "midi.h"
 #include "midi_helper.h"
 #include "midi_constants.h"
+#include "midi_packed.h"
+#include "midi_stream.h"
+#include "midi_batch.h"
+#include "midi_merge.h"
+#include "midi_tempo.h"
+#include "midi_seek.h"
+#include "midi_notes.h"
+#include "midi_play.h"
+#include "midi_transform.h"
+#include "midi_quantize.h"
 
 #include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 void test_varlen(){
 	size_t size;
@@ -15,6 +31,37 @@ void test_varlen(){
 	printf("\t|\t%x\n", len);
 	free(num);
 	num = NULL;
+
+	uint32_t values[] = {0, 0x40, 0x7F, 0x80, 0x2000, 0x3FFF, 0x4000, 0x100000, 0x1FFFFF, 0x200000, 0x8000000, 0x0FFFFFFF};
+	for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i){
+		uint8_t var[VARLEN_MAX_LEN];
+		size_t written = varlen_encode(values[i], var);
+		assert(written == varlen_size(values[i]));
+		uint32_t val;
+		assert(!varlen_to_int_checked(var, written, &val, &read_size));
+		assert(val == values[i] && read_size == written);
+		assert(varlen_to_int(var, NULL) == values[i]);
+		if(written > 1){
+			assert(varlen_to_int_checked(var, written - 1, &val, &read_size) == -1);
+		}
+	}
+
+	//VARLEN_MAX is the largest quantity, in VARLEN_MAX_LEN bytes, and a 5th byte is an error even if there is room
+	uint8_t longest[VARLEN_MAX_LEN + 1] = {0xFF, 0xFF, 0xFF, 0x7F, 0x00};
+	uint8_t var[VARLEN_MAX_LEN];
+	assert(varlen_encode(VARLEN_MAX, var) == VARLEN_MAX_LEN && !memcmp(var, longest, VARLEN_MAX_LEN));
+	uint32_t val;
+	assert(!varlen_to_int_checked(longest, sizeof(longest), &val, &read_size));
+	assert(val == VARLEN_MAX && read_size == VARLEN_MAX_LEN);
+	uint8_t too_long[VARLEN_MAX_LEN + 1] = {0x81, 0x80, 0x80, 0x80, 0x00};
+	assert(varlen_to_int_checked(too_long, sizeof(too_long), &val, &read_size) == -1);
+
+	//a note on with a two byte delta time, an end of track with a one byte delta time, then a truncated event
+	uint8_t body[] = {0x83, 0x00, 0x90, 0x3C, 0x40, 0x10, 0xFF, 0x2F, 0x00, 0x05};
+	uint32_t delta_times[4];
+	assert(decode_delta_times(body, sizeof(body), delta_times, 4) == 2);
+	assert(delta_times[0] == 384 && delta_times[1] == 16);
+	assert(decode_delta_times(body, sizeof(body), NULL, 1) == 1);
 }
 
 void test_read_write(){
@@ -169,7 +216,7 @@ void test_read_write(){
 			struct MidiEvent* event = track->events[j];
 			printf("\t\tEvent[%zu]: <%u> - ", j, event->delta_time);
 			for(size_t k = 0; k < event->event_len; ++k){
-				printf("%02X ", event->event[k]);
+				printf("%02X ", midi_event_data(event)[k]);
 			}
 			printf("\n");
 		}
@@ -235,6 +282,1689 @@ void test_helper_midi(){
 	
 }
 
+int midi_equal(struct Midi* a, struct Midi* b){
+	if(a->chunk_count != b->chunk_count){
+		return 0;
+	}
+	for(size_t i = 0; i < a->chunk_count; ++i){
+		if(a->chunks[i]->type_e != b->chunks[i]->type_e){
+			return 0;
+		}
+		if(a->chunks[i]->type_e == CHUNK_HEADER){
+			struct MidiHeaderChunk* ha = (struct MidiHeaderChunk*) a->chunks[i]->chunk;
+			struct MidiHeaderChunk* hb = (struct MidiHeaderChunk*) b->chunks[i]->chunk;
+			if(ha->format != hb->format || ha->tracks != hb->tracks || ha->division != hb->division){
+				return 0;
+			}
+			continue;
+		}
+		struct MidiTrackChunk* ta = midi_chunk_track(a->chunks[i]);
+		struct MidiTrackChunk* tb = midi_chunk_track(b->chunks[i]);
+		if(!ta || !tb || ta->event_count != tb->event_count){
+			return 0;
+		}
+		for(size_t j = 0; j < ta->event_count; ++j){
+			struct MidiEvent* ea = ta->events[j];
+			struct MidiEvent* eb = tb->events[j];
+			if(ea->delta_time != eb->delta_time || ea->event_len != eb->event_len || memcmp(midi_event_data(ea), midi_event_data(eb), ea->event_len)){
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+void test_mmap(){
+	FILE* f = fopen("test.mid", "rb");
+	struct Midi* m = read_midi(f);
+	fclose(f);
+	f = NULL;
+
+	struct MidiMap* map = open_midi_mmap("test.mid");
+	assert(map);
+	assert(midi_equal(m, map->midi));
+	printf("Mapped test.mid (%zu bytes) with %u chunks\n", map->size, map->midi->chunk_count);
+	//the mapping is read-only, so an event is copied before it is changed
+	struct MidiEvent* e = midi_track(map->midi, 0)->events[0];
+	assert(e->storage == EVENT_STORAGE_BORROWED);
+	const uint8_t* mapped = midi_event_data(e);
+	uint8_t* changed = midi_event_data_mutable(e);
+	changed[e->event_len - 1] ^= 1;
+	assert(changed != mapped && e->storage == EVENT_STORAGE_OWNED && !midi_equal(m, map->midi));
+	close_midi_mmap(map);
+	map = NULL;
+
+	free_midi(m);
+	free(m);
+	m = NULL;
+
+	assert(!open_midi_mmap("does_not_exist.mid"));
+}
+
+void test_lazy(){
+	//a format 1 file with many tracks, where only one is looked at
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 1, 100, 480);
+	for(size_t t = 0; t < 100; ++t){
+		struct MidiTrackChunk* track = midi_add_track(m);
+		for(size_t i = 0; i < 50; ++i){
+			uint8_t note[3] = {0x90 | (t & 0x0F), 40 + i, (i & 1) ? 0 : 100};
+			track_add_event_full(track, 10 * (i & 1), note, 3);
+		}
+		uint8_t end[3] = {0xFF, 0x2F, 0x00};
+		track_add_event_full(track, 0, end, 3);
+	}
+	size_t size = 0;
+	uint8_t* data = write_midi_to_buffer(m, WRITE_RUNNING_STATUS, NULL, &size);
+
+	struct Midi* lazy = read_midi_buffer_lazy(data, size);
+	assert(lazy && lazy->chunk_count == 101 && lazy->header->tracks == 100);
+	struct MidiTrackChunk* track = midi_track(lazy, 50);
+	assert(track && track->event_count == 51 && midi_event_data(track->events[2])[0] == 0x92);
+	assert(midi_track(lazy, 50) == track);
+	for(uint32_t i = 1; i < lazy->chunk_count; ++i){
+		assert(!lazy->chunks[i]->pending == (i == 51));
+	}
+	assert(!midi_track(lazy, 100) && !midi_chunk_track(lazy->chunks[0]));
+	//anything which walks the tracks decodes the rest
+	assert(midi_equal(m, lazy));
+	free_midi(lazy);
+	free(lazy);
+
+	//writing decodes whatever has not been accessed yet
+	lazy = read_midi_buffer_lazy(data, size);
+	size_t out_size = 0;
+	uint8_t* out = write_midi_to_buffer(lazy, WRITE_RUNNING_STATUS, NULL, &out_size);
+	assert(out_size == size && !memcmp(out, data, size));
+	free(out);
+	free_midi(lazy);
+	free(lazy);
+
+	//a malformed track is only noticed once it is accessed, and then stays empty
+	size_t pos = 14;
+	for(size_t t = 0; t < 3; ++t){
+		pos += 8 + load_uint32_t(data + pos + 4);
+	}
+	//the status byte of the first event, which cannot be left out
+	data[pos + 8 + 1] = 0x40;
+	lazy = read_midi_buffer_lazy(data, size);
+	assert(lazy && midi_track(lazy, 2) && !midi_track(lazy, 3) && !midi_track(lazy, 3));
+	struct MidiMerge merge;
+	midi_merge_open(&merge, lazy);
+	assert(merge.track_count == 100 && merge.tracks[3]->event_count == 0);
+	midi_merge_close(&merge);
+	out = write_midi_to_buffer(lazy, 0, NULL, &out_size);
+	struct Midi* back = read_midi_buffer(out, out_size);
+	assert(back && midi_track(back, 3)->event_count == 0 && midi_track(back, 4)->event_count == 51);
+	free_midi(back);
+	free(back);
+	free(out);
+	free_midi(lazy);
+	free(lazy);
+	assert(!read_midi_buffer_lazy(data, 20));
+	free(data);
+	free_midi(m);
+	free(m);
+
+	FILE* f = fopen("test.mid", "rb");
+	m = read_midi(f);
+	fclose(f);
+	struct MidiMap* map = open_midi_mmap_lazy("test.mid");
+	assert(map && midi_equal(m, map->midi));
+	close_midi_mmap(map);
+	free_midi(m);
+	free(m);
+	printf("Lazily decoded 1 of 100 tracks\n");
+}
+
+void test_arena(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi_arena(m, 256);
+	midi_add_header(m, 1, 2, 384);
+	for(size_t t = 0; t < 2; ++t){
+		struct MidiTrackChunk* track = midi_add_track(m);
+		for(uint8_t note = 0; note < 100; ++note){
+			uint8_t ev[3] = {0x90, note, 0x40};
+			track_add_event_full(track, 0, ev, 3);
+			ev[0] = 0x80;
+			track_add_event_full(track, 96, ev, 3);
+		}
+		//populated by hand, so its bytes are allocated outside the arena and freed along with the track
+		uint8_t name[12] = {0xFF, 0x03, 9, 'a', 'r', 'e', 'n', 'a', ' ', 'o', 'u', 't'};
+		new_midi_event(track_add_event(track), 0, name, sizeof(name));
+		uint8_t stop_event[] = {0xff, 0x2f, 0x00};
+		track_add_event_full(track, 0, stop_event, 3);
+	}
+
+	FILE* f = fopen("arena.mid", "wb");
+	write_midi(m, f);
+	fclose(f);
+	free_midi(m);
+	free(m);
+
+	f = fopen("arena.mid", "rb");
+	struct Midi* heap = read_midi(f);
+	rewind(f);
+	struct Midi* arena = read_midi_arena(f);
+	fclose(f);
+	f = NULL;
+	assert(arena);
+	assert(midi_equal(heap, arena));
+	printf("Read arena.mid into an arena with %u chunks\n", arena->chunk_count);
+
+	free_midi(heap);
+	free(heap);
+	free_midi(arena);
+	free(arena);
+}
+
+void test_packed(){
+	FILE* f = fopen("test.mid", "rb");
+	struct Midi* m = read_midi(f);
+	fclose(f);
+
+	f = fopen("packed.mid", "wb");
+	fwrite("MThd", sizeof(uint8_t), TYPE_LEN, f);
+	write_uint32_t(HEADER_LEN, f);
+	write_uint16_t(m->header->format, f);
+	write_uint16_t(m->header->tracks, f);
+	write_uint16_t(m->header->division, f);
+	size_t events = 0;
+	for(size_t i = 1; i < m->chunk_count; ++i){
+		struct MidiPackedTrack packed;
+		new_packed_track(&packed);
+		packed_track_from_track(&packed, (struct MidiTrackChunk*) m->chunks[i]->chunk);
+		events += packed.event_count;
+		write_packed_track(&packed, f);
+		free_packed_track(&packed);
+	}
+	fclose(f);
+
+	f = fopen("packed.mid", "rb");
+	struct Midi* m2 = read_midi(f);
+	fclose(f);
+	f = NULL;
+	assert(midi_equal(m, m2));
+
+	//parse a track body straight into columns. The first delta time of the track is a single byte
+	struct MidiMap* map = open_midi_mmap("packed.mid");
+	struct MidiTrackChunk* track1 = (struct MidiTrackChunk*) map->midi->chunks[2]->chunk;
+	const uint8_t* body = midi_event_data(track1->events[0]) - 1;
+	struct MidiPackedTrack packed;
+	new_packed_track(&packed);
+	assert(!parse_packed_track(&packed, body, 0) && packed.event_count == 0);
+	struct MidiPackedTrack from;
+	new_packed_track(&from);
+	packed_track_from_track(&from, track1);
+	assert(!parse_packed_track(&packed, body, packed_track_length(&from)));
+	assert(packed.event_count == track1->event_count);
+	for(size_t i = 0; i < packed.event_count; ++i){
+		size_t len;
+		const uint8_t* ev = packed_track_event(&packed, i, &len);
+		assert(packed.delta_time[i] == track1->events[i]->delta_time && len == track1->events[i]->event_len);
+		assert(!memcmp(ev, midi_event_data(track1->events[i]), len));
+	}
+
+	//whole files go straight into packed tracks and back out
+	f = fopen("packed.mid", "rb");
+	struct MidiPacked* whole = read_midi_packed(f);
+	fclose(f);
+	assert(whole && whole->track_count == m->header->tracks && whole->division == m->header->division);
+	assert(whole->tracks[1].event_count == track1->event_count && whole->tracks[1].pool_len == from.pool_len);
+	f = fopen("packed_whole.mid", "wb");
+	write_midi_packed(whole, f);
+	fclose(f);
+	f = fopen("packed_whole.mid", "rb");
+	struct Midi* m3 = read_midi(f);
+	fclose(f);
+	assert(midi_equal(m, m3));
+	free_midi(m3);
+	free(m3);
+	free_midi_packed(whole);
+	free(whole);
+	assert(!read_midi_packed_buffer(body, 16));
+
+	printf("Packed %zu events into columns\n", events);
+	free_packed_track(&from);
+	free_packed_track(&packed);
+	close_midi_mmap(map);
+
+	free_midi(m);
+	free(m);
+	free_midi(m2);
+	free(m2);
+}
+
+void test_inline_events(){
+	struct MidiTrackChunk track;
+	new_midi_track(&track);
+	uint8_t note[] = {0x90, 0x3C, 0x40};
+	uint8_t text[] = {0xFF, 0x01, 0x0A, 'h', 'e', 'l', 'l', 'o', ' ', 'm', 'i', 'd', 'i'};
+	struct MidiEvent* short_event = track_add_event_full(&track, 0, note, 3);
+	struct MidiEvent* long_event = track_add_event_full(&track, 0, text, 13);
+	assert(short_event->storage == EVENT_STORAGE_INLINE);
+	assert(long_event->storage == EVENT_STORAGE_OWNED);
+	assert(!memcmp(midi_event_data(short_event), note, 3));
+	assert(!memcmp(midi_event_data(long_event), text, 13));
+	printf("Events are %zu bytes, up to %d stored inline\n", sizeof(struct MidiEvent), EVENT_INLINE_LEN);
+	free_midi_track(&track);
+}
+
+void test_reserve(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_reserve_chunks(m, 2);
+	assert(m->chunk_capacity == 2);
+	midi_add_header(m, 0, 1, 384);
+	struct MidiTrackChunk* track = midi_add_track(m);
+	assert(m->chunk_capacity == 2);
+
+	track_reserve(track, 1000);
+	assert(track->event_capacity == 1000);
+	uint8_t ev[3] = {0x90, 0x3C, 0x40};
+	for(size_t i = 0; i < 100000; ++i){
+		track_add_event_full(track, 10, ev, 3);
+	}
+	assert(track->event_capacity >= track->event_count);
+	midi_shrink_to_fit(m);
+	assert(track->event_capacity == track->event_count);
+	printf("Built a %zu event track\n", track->event_count);
+
+	free_midi(m);
+	free(m);
+}
+
+void test_ticks(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 0, 1, 384);
+	struct MidiTrackChunk* track = midi_add_track(m);
+	assert(track_find_tick(track, 0) == 0);
+
+	uint8_t ev[3] = {0x90, 0x3C, 0x40};
+	for(size_t i = 0; i < 1001; ++i){
+		//some events share a tick
+		track_add_event_full(track, i % 3 ? 10 : 0, ev, 3);
+	}
+	const uint64_t* ticks = track_ticks(track);
+	uint64_t tick = 0;
+	for(size_t i = 0; i < track->event_count; ++i){
+		tick += track->events[i]->delta_time;
+		assert(ticks[i] == tick);
+	}
+	assert(track_find_tick(track, 0) == 0);
+	assert(track_find_tick(track, 10) == 1);
+	assert(track_find_tick(track, 11) == 2);
+	assert(track_find_tick(track, 20) == 2);
+	assert(track_find_tick(track, tick - 10) == 998);
+	assert(track_find_tick(track, tick + 1) == track->event_count);
+
+	//appending extends the cache
+	track_add_event_full(track, 5, ev, 3);
+	assert(track_ticks(track)[track->event_count - 1] == tick + 5);
+
+	//changing a delta time needs an invalidate
+	track->events[500]->delta_time += 100;
+	track_invalidate_ticks(track, 500);
+	ticks = track_ticks(track);
+	assert(ticks[499] + track->events[500]->delta_time == ticks[500]);
+	assert(ticks[track->event_count - 1] == tick + 105);
+	printf("Found tick %llu at event %zu\n", (unsigned long long) tick, track_find_tick(track, tick));
+
+	free_midi(m);
+	free(m);
+}
+
+/*
+ * Checks that the reader yields exactly the events of `m`
+ */
+void check_reader(struct MidiReader* reader, struct Midi* m){
+	struct MidiReaderEvent ev;
+	size_t chunk = 0;
+	size_t index = 0;
+	int r;
+	while((r = midi_reader_next_event(reader, &ev)) == 1){
+		struct MidiTrackChunk* track = (struct MidiTrackChunk*) m->chunks[chunk]->chunk;
+		while(m->chunks[chunk]->type_e != CHUNK_TRACK || index == track->event_count){
+			chunk++;
+			index = 0;
+			track = (struct MidiTrackChunk*) m->chunks[chunk]->chunk;
+		}
+		struct MidiEvent* e = track->events[index++];
+		assert(ev.track == chunk - 1);
+		assert(ev.delta_time == e->delta_time && ev.event_len == e->event_len);
+		assert(!memcmp(ev.event, midi_event_data(e), ev.event_len));
+	}
+	assert(r == 0);
+	assert(reader->format == m->header->format && reader->tracks == m->header->tracks);
+}
+
+void test_stream(){
+	FILE* f = fopen("test.mid", "rb");
+	struct Midi* m = read_midi(f);
+	rewind(f);
+	struct MidiReader reader;
+	assert(!midi_reader_open_file(&reader, f));
+	check_reader(&reader, m);
+	midi_reader_close(&reader);
+	fclose(f);
+	free_midi(m);
+	free(m);
+
+	//an event larger than the reader's buffer
+	m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 0, 1, 384);
+	struct MidiTrackChunk* track = midi_add_track(m);
+	size_t dump_len = READER_BUFFER_LEN * 3;
+	uint8_t* dump = calloc(dump_len, sizeof(uint8_t));
+	dump[0] = 0xF0;
+	size_t len_size = varlen_encode(dump_len - 4, dump + 1);
+	assert(len_size == 3);
+	uint8_t ev[3] = {0x90, 0x3C, 0x40};
+	track_add_event_full(track, 0, ev, 3);
+	track_add_event_full(track, 10, dump, dump_len);
+	track_add_event_full(track, 20, ev, 3);
+	free(dump);
+	f = fopen("stream.mid", "w+b");
+	write_midi(m, f);
+	rewind(f);
+	assert(!midi_reader_open_file(&reader, f));
+	check_reader(&reader, m);
+	midi_reader_close(&reader);
+
+	//and the same from memory
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	uint8_t* data = malloc(size);
+	rewind(f);
+	assert(fread(data, 1, size, f) == (size_t) size);
+	fclose(f);
+	f = NULL;
+	assert(!midi_reader_open_buffer(&reader, data, size));
+	check_reader(&reader, m);
+	midi_reader_close(&reader);
+
+	//a truncated file is an error
+	assert(!midi_reader_open_buffer(&reader, data, size - 100));
+	struct MidiReaderEvent e;
+	while(midi_reader_next_event(&reader, &e) == 1);
+	assert(midi_reader_next_event(&reader, &e) == -1);
+	midi_reader_close(&reader);
+	free(data);
+	printf("Streamed stream.mid (%ld bytes)\n", size);
+
+	free_midi(m);
+	free(m);
+}
+
+/*
+ * Writes a 2 track file with `notes` notes in the second track through a `MidiWriter`
+ */
+void write_with_writer(FILE* f, size_t notes){
+	struct MidiWriter writer;
+	assert(!midi_writer_open(&writer, f, 1, 2, 384));
+	uint8_t tempo_event[] = {0xff, 0x51, 0x03, 0x07, 0xA1, 0x20};
+	uint8_t stop_event[] = {0xff, 0x2f, 0x00};
+	midi_writer_begin_track(&writer);
+	midi_writer_event(&writer, 0, tempo_event, 6);
+	midi_writer_event(&writer, 0, stop_event, 3);
+	midi_writer_end_track(&writer);
+
+	midi_writer_begin_track(&writer);
+	for(size_t i = 0; i < notes; ++i){
+		uint8_t ev[3] = {0x90, i % 128, 0x40};
+		midi_writer_event(&writer, 0, ev, 3);
+		ev[0] = 0x80;
+		midi_writer_event(&writer, 96, ev, 3);
+	}
+	midi_writer_event(&writer, 0, stop_event, 3);
+	midi_writer_end_track(&writer);
+	assert(!midi_writer_close(&writer));
+}
+
+void test_writer(){
+	FILE* f = fopen("writer.mid", "wb");
+	write_with_writer(f, 50000);
+	fclose(f);
+
+	//a pipe cannot be seeked, so the tracks spill into a temporary file
+	f = popen("cat > writer_pipe.mid", "w");
+	write_with_writer(f, 50000);
+	pclose(f);
+
+	f = fopen("writer.mid", "rb");
+	struct Midi* m = read_midi(f);
+	fclose(f);
+	f = fopen("writer_pipe.mid", "rb");
+	struct Midi* m2 = read_midi(f);
+	fclose(f);
+	f = NULL;
+	assert(midi_equal(m, m2));
+	struct MidiTrackChunk* track = (struct MidiTrackChunk*) m->chunks[2]->chunk;
+	assert(track->event_count == 100001);
+	printf("Streamed %zu events into writer.mid\n", track->event_count);
+
+	free_midi(m);
+	free(m);
+	free_midi(m2);
+	free(m2);
+}
+
+void test_running_status(){
+	FILE* f = fopen("writer.mid", "rb");
+	struct Midi* m = read_midi(f);
+	fclose(f);
+
+	f = fopen("running.mid", "wb");
+	write_midi_flags(m, f, WRITE_RUNNING_STATUS);
+	long running_size = ftell(f);
+	fclose(f);
+	f = fopen("compact.mid", "w+b");
+	write_midi_flags(m, f, WRITE_COMPACT);
+	long compact_size = ftell(f);
+	rewind(f);
+	struct Midi* compact = read_midi(f);
+	fclose(f);
+
+	//running status alone reads back exactly the same events
+	f = fopen("running.mid", "rb");
+	struct Midi* running = read_midi(f);
+	fclose(f);
+	f = NULL;
+	assert(midi_equal(m, running));
+	struct MidiMap* map = open_midi_mmap("running.mid");
+	assert(map && midi_equal(m, map->midi));
+	close_midi_mmap(map);
+
+	//note offs come back as note ons with no velocity
+	struct MidiTrackChunk* track = (struct MidiTrackChunk*) m->chunks[2]->chunk;
+	struct MidiTrackChunk* compact_track = (struct MidiTrackChunk*) compact->chunks[2]->chunk;
+	assert(track->event_count == compact_track->event_count);
+	const uint8_t* off = midi_event_data(track->events[1]);
+	const uint8_t* on = midi_event_data(compact_track->events[1]);
+	assert(off[0] == 0x80 && on[0] == 0x90 && on[1] == off[1] && on[2] == 0);
+	assert(compact_size < running_size);
+
+	//the packed parser fills in the status bytes too
+	f = fopen("compact.mid", "rb");
+	uint8_t* data = malloc(compact_size);
+	assert(fread(data, 1, compact_size, f) == (size_t) compact_size);
+	fclose(f);
+	size_t body = 14 + 8 + load_uint32_t(data + 14 + 4) + 8;
+	struct MidiPackedTrack packed;
+	new_packed_track(&packed);
+	assert(!parse_packed_track(&packed, data + body, load_uint32_t(data + body - 4)));
+	assert(packed.event_count == compact_track->event_count);
+	for(size_t i = 0; i < packed.event_count; ++i){
+		size_t len;
+		const uint8_t* ev = packed_track_event(&packed, i, &len);
+		assert(len == compact_track->events[i]->event_len && !memcmp(ev, midi_event_data(compact_track->events[i]), len));
+	}
+	free_packed_track(&packed);
+	free(data);
+
+	struct MidiReader reader;
+	f = fopen("running.mid", "rb");
+	assert(!midi_reader_open_file(&reader, f));
+	check_reader(&reader, m);
+	midi_reader_close(&reader);
+	fclose(f);
+	f = NULL;
+
+	size_t full_size = 14;
+	for(size_t i = 1; i < m->chunk_count; ++i){
+		full_size += 8 + track_length((struct MidiTrackChunk*) m->chunks[i]->chunk);
+	}
+	printf("Running status: %zu bytes -> %ld bytes, compacted to %ld bytes\n", full_size, running_size, compact_size);
+
+	free_midi(m);
+	free(m);
+	free_midi(running);
+	free(running);
+	free_midi(compact);
+	free(compact);
+}
+
+uint8_t* read_whole_file(const char* path, size_t* size){
+	FILE* f = fopen(path, "rb");
+	fseek(f, 0, SEEK_END);
+	(*size) = ftell(f);
+	rewind(f);
+	uint8_t* data = malloc((*size) + 1);
+	assert(fread(data, 1, *size, f) == *size);
+	fclose(f);
+	return data;
+}
+
+void test_write_buffer(){
+	FILE* f = fopen("writer.mid", "rb");
+	struct Midi* m = read_midi(f);
+	fclose(f);
+
+	//the buffer holds exactly what write_midi_flags writes, with every set of flags
+	unsigned flags[3] = {0, WRITE_RUNNING_STATUS, WRITE_COMPACT};
+	for(size_t i = 0; i < 3; ++i){
+		f = fopen("buffer.mid", "wb");
+		write_midi_flags(m, f, flags[i]);
+		fclose(f);
+		size_t file_size;
+		uint8_t* file = read_whole_file("buffer.mid", &file_size);
+
+		size_t size = 0;
+		uint8_t* buffer = write_midi_to_buffer(m, flags[i], NULL, &size);
+		assert(size == file_size && size == midi_length_flags(m, flags[i]));
+		assert(!memcmp(buffer, file, size));
+
+		//a caller's buffer which is too small is left alone
+		size_t small = size - 1;
+		assert(!write_midi_to_buffer(m, flags[i], buffer, &small));
+		assert(small == size);
+		memset(buffer, 0, size);
+		assert(write_midi_to_buffer(m, flags[i], buffer, &small) == buffer);
+		assert(!memcmp(buffer, file, size));
+		free(buffer);
+		free(file);
+	}
+	free_midi(m);
+	free(m);
+
+	//more long sysex events than fit in one writev, and more short ones than fit in the staging buffer
+	m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 0, 1, 480);
+	struct MidiTrackChunk* track = midi_add_track(m);
+	uint8_t sysex[200];
+	sysex[0] = 0xF0;
+	sysex[1] = 0x81;
+	sysex[2] = 0x45;
+	for(size_t i = 0; i < 1000; ++i){
+		for(size_t j = 3; j < sizeof(sysex) - 1; ++j){
+			sysex[j] = (i + j) & 0x7F;
+		}
+		sysex[sizeof(sysex) - 1] = 0xF7;
+		track_add_event_full(track, i, sysex, sizeof(sysex));
+		for(size_t j = 0; j < 20; ++j){
+			uint8_t note[3] = {0x90, j, i & 0x7F};
+			track_add_event_full(track, j, note, 3);
+		}
+	}
+	uint8_t end[3] = {0xFF, 0x2F, 0x00};
+	track_add_event_full(track, 0, end, 3);
+
+	size_t size = 0;
+	uint8_t* buffer = write_midi_to_buffer(m, WRITE_COMPACT, NULL, &size);
+	int fd = open("writev.mid", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd >= 0);
+	assert(!write_midi_fd(m, fd, WRITE_COMPACT));
+	close(fd);
+	size_t file_size;
+	uint8_t* file = read_whole_file("writev.mid", &file_size);
+	assert(file_size == size && !memcmp(file, buffer, size));
+
+	struct Midi* back = read_midi_buffer(buffer, size);
+	assert(back && midi_equal(m, back));
+	printf("wrote %zu bytes to a buffer and with writev\n", size);
+
+	free_midi(back);
+	free(back);
+	free(file);
+	free(buffer);
+	free_midi(m);
+	free(m);
+}
+
+void test_serialized(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 1, 60, 480);
+	for(size_t t = 0; t < 60; ++t){
+		struct MidiTrackChunk* track = midi_add_track(m);
+		for(size_t i = 0; i < 100; ++i){
+			uint8_t note[3] = {(i & 1) ? 0x80 : 0x90, 40 + (i + t) % 40, 100};
+			track_add_event_full(track, 10, note, 3);
+		}
+	}
+	//the first write encodes straight into the buffer, only remembering the length of each track
+	size_t size = 0;
+	uint8_t* first = write_midi_to_buffer(m, WRITE_COMPACT, NULL, &size);
+	for(uint16_t t = 0; t < 60; ++t){
+		assert(!midi_track(m, t)->dirty && !midi_track(m, t)->serialized);
+	}
+	assert(midi_length_flags(m, WRITE_COMPACT) == size);
+	//and the second keeps the bytes of the tracks written unchanged
+	size_t again_size = 0;
+	uint8_t* again = write_midi_to_buffer(m, WRITE_COMPACT, NULL, &again_size);
+	assert(again_size == size && !memcmp(again, first, size));
+	free(again);
+	for(uint16_t t = 0; t < 60; ++t){
+		assert(midi_track(m, t)->serialized);
+	}
+
+	//an unchanged track is written from the bytes kept from last time
+	struct MidiTrackChunk* track = midi_track(m, 7);
+	size_t len;
+	const uint8_t* kept = track_serialized(track, WRITE_COMPACT, &len);
+	assert(track_serialized(track, WRITE_COMPACT, &len) == kept && len == track_length_flags(track, WRITE_COMPACT));
+
+	//only the changed tracks are encoded again
+	uint8_t end[3] = {0xFF, 0x2F, 0x00};
+	track_add_event_full(track, 0, end, 3);
+	midi_event_data_mutable(midi_track(m, 30)->events[4])[2] = 1;
+	track_mark_dirty(midi_track(m, 30));
+	for(uint16_t t = 0; t < 60; ++t){
+		assert(midi_track(m, t)->dirty == (t == 7 || t == 30));
+	}
+	uint8_t* second = write_midi_to_buffer(m, WRITE_COMPACT, NULL, &size);
+	struct Midi* back = read_midi_buffer(second, size);
+	assert(back && midi_track(back, 7)->event_count == 101 && midi_event_data(midi_track(back, 30)->events[4])[2] == 1);
+	free_midi(back);
+	free(back);
+
+	//the same as a fresh encoding of every event
+	for(uint16_t t = 0; t < 60; ++t){
+		track_mark_dirty(midi_track(m, t));
+	}
+	size_t fresh_size = 0;
+	uint8_t* fresh = write_midi_to_buffer(m, WRITE_COMPACT, NULL, &fresh_size);
+	assert(fresh_size == size && !memcmp(fresh, second, size));
+	free(fresh);
+	FILE* f = fopen("serialized.mid", "w+b");
+	write_midi_flags(m, f, WRITE_COMPACT);
+	assert((size_t) ftell(f) == size);
+	rewind(f);
+	uint8_t* file = malloc(size);
+	assert(fread(file, 1, size, f) == size);
+	fclose(f);
+	assert(!memcmp(file, second, size));
+
+	//other flags replace the kept bytes
+	kept = track_serialized(track, 0, &len);
+	assert(len == track_length(track) && len > track_length_flags(track, WRITE_COMPACT));
+	assert(!memcmp(kept + 1, midi_event_data(track->events[0]), 3));
+
+	//delta times changed in place are picked up through track_invalidate_ticks
+	track->events[0]->delta_time = 200;
+	track_invalidate_ticks(track, 0);
+	kept = track_serialized(track, 0, &len);
+	assert(kept[0] == 0x81 && kept[1] == 0x48);
+	printf("Rewrote 2 of 60 tracks\n");
+
+	free(file);
+	free(first);
+	free(second);
+	free_midi(m);
+	free(m);
+}
+
+struct PooledRead {
+	struct MidiPayloadPool* pool;
+	struct Midi* midi;
+};
+
+static void* read_pooled_worker(void* arg){
+	struct PooledRead* read = (struct PooledRead*) arg;
+	FILE* f = fopen("pool.mid", "rb");
+	read->midi = read_midi_pooled(f, read->pool);
+	fclose(f);
+	return NULL;
+}
+
+void test_pool(){
+	struct MidiPayloadPool pool;
+	new_payload_pool(&pool);
+
+	//the same patch dump and copyright notice in every track, with a name of its own
+	uint8_t dump[2048];
+	dump[0] = 0xF0;
+	dump[1] = 0x8F;
+	dump[2] = 0x7D;
+	for(size_t i = 3; i < sizeof(dump) - 1; ++i){
+		dump[i] = i & 0x7F;
+	}
+	dump[sizeof(dump) - 1] = 0xF7;
+	char copyright[] = "(c) 2026 Patch Library";
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	m->pool = &pool;
+	midi_add_header(m, 1, 3, 480);
+	for(size_t t = 0; t < 3; ++t){
+		struct MidiTrackChunk* track = midi_add_track(m);
+		struct EventString ev;
+		new_event_string(&ev);
+		add_meta_message(&ev, META_COPYRIGHT_NOTICE);
+		add_string(&ev, copyright, strlen(copyright));
+		track_add_event_full(track, 0, ev.event_string, ev.event_string_len);
+		free_event_string(&ev);
+
+		char name[16];
+		snprintf(name, sizeof(name), "Patch %zu", t);
+		new_event_string(&ev);
+		add_meta_message(&ev, META_TRACK_NAME);
+		add_string(&ev, name, strlen(name));
+		track_add_event_full(track, 0, ev.event_string, ev.event_string_len);
+		free_event_string(&ev);
+
+		track_add_event_full(track, 0, dump, sizeof(dump));
+		uint8_t end[3] = {0xFF, META_END_OF_TRACK, 0x00};
+		track_add_event_full(track, 0, end, 3);
+	}
+	assert(midi_track(m, 0)->events[2]->storage == EVENT_STORAGE_POOLED);
+	assert(midi_event_data(midi_track(m, 0)->events[2]) == midi_event_data(midi_track(m, 2)->events[2]));
+	assert(midi_event_data(midi_track(m, 0)->events[1]) != midi_event_data(midi_track(m, 1)->events[1]));
+	struct MidiPoolStats stats;
+	payload_pool_stats(&pool, &stats);
+	assert(stats.payloads == 5 && stats.references == 9);
+	assert(stats.referenced_bytes - stats.payload_bytes == 2 * (sizeof(dump) + 2 + 1 + strlen(copyright)));
+
+	FILE* f = fopen("pool.mid", "wb");
+	write_midi(m, f);
+	fclose(f);
+
+	//files read on several threads share the one pool
+	pthread_t threads[4];
+	struct PooledRead reads[4];
+	for(size_t i = 0; i < 4; ++i){
+		reads[i].pool = &pool;
+		assert(!pthread_create(&threads[i], NULL, read_pooled_worker, &reads[i]));
+	}
+	for(size_t i = 0; i < 4; ++i){
+		pthread_join(threads[i], NULL);
+		assert(reads[i].midi && midi_equal(m, reads[i].midi));
+	}
+	payload_pool_stats(&pool, &stats);
+	assert(stats.payloads == 5 && stats.references == 45);
+	printf("Pooled %zu references to %zu payloads, %zu bytes instead of %zu\n", stats.references, stats.payloads, stats.payload_bytes, stats.referenced_bytes);
+
+	//payloads are freed once nothing refers to them
+	free_midi(m);
+	free(m);
+	for(size_t i = 0; i < 4; ++i){
+		free_midi(reads[i].midi);
+		free(reads[i].midi);
+	}
+	//changing a pooled event gives it bytes of its own, leaving the events sharing them alone
+	struct MidiEvent a;
+	struct MidiEvent b;
+	new_midi_event_pooled(&a, &pool, 0, dump, sizeof(dump));
+	new_midi_event_pooled(&b, &pool, 0, dump, sizeof(dump));
+	midi_event_data_mutable(&a)[2] ^= 1;
+	assert(a.storage == EVENT_STORAGE_OWNED && midi_event_data(&a)[2] != dump[2] && !memcmp(midi_event_data(&b), dump, sizeof(dump)));
+	payload_pool_stats(&pool, &stats);
+	assert(stats.payloads == 1 && stats.references == 1);
+	free_midi_event(&a);
+	free_midi_event(&b);
+
+	payload_pool_stats(&pool, &stats);
+	assert(!stats.payloads && !stats.references && !stats.payload_bytes);
+	free_payload_pool(&pool);
+}
+
+static void* write_clone_worker(void* arg){
+	struct Midi* clone = (struct Midi*) arg;
+	//writing twice would keep the bytes of an unshared track, and the ticks are read while finding a tick
+	for(size_t i = 0; i < 2; ++i){
+		size_t size = 0;
+		free(write_midi_to_buffer(clone, WRITE_COMPACT, NULL, &size));
+		assert(size == midi_length_flags(clone, WRITE_COMPACT));
+	}
+	struct MidiTrackChunk* track = midi_track(clone, 1);
+	assert(track_find_tick(track, track_ticks(track)[3]) <= 3);
+	free_midi(clone);
+	free(clone);
+	return NULL;
+}
+
+static void* transpose_clone_worker(void* arg){
+	struct Midi* clone = (struct Midi*) arg;
+	struct MidiTrackChunk* track = midi_track_writable(clone, 1);
+	for(size_t i = 0; i < track->event_count; ++i){
+		uint8_t* data = midi_event_data_mutable(track->events[i]);
+		if((data[0] & 0xE0) == 0x80){
+			data[1]++;
+		}
+	}
+	track_mark_dirty(track);
+	free_midi(clone);
+	free(clone);
+	return NULL;
+}
+
+void test_clone(){
+	FILE* f = fopen("writer.mid", "rb");
+	struct Midi* m = read_midi(f);
+	fclose(f);
+	f = fopen("writer.mid", "rb");
+	struct Midi* original = read_midi(f);
+	fclose(f);
+
+	//every track is shared until it is changed
+	struct Midi* clone = midi_clone(m);
+	assert(clone && midi_equal(m, clone));
+	for(uint32_t t = 0; t < m->header->tracks; ++t){
+		assert(midi_track(clone, t) == midi_track(m, t) && midi_track(m, t)->refs == 2);
+	}
+	struct MidiTrackChunk* shared = midi_track(m, 1);
+	struct MidiTrackChunk* track = midi_track_writable(clone, 1);
+	assert(track != shared && shared->refs == 1 && track->refs == 1);
+	assert(midi_track(clone, 0) == midi_track(m, 0) && midi_track_writable(clone, 1) == track);
+	uint8_t* note = midi_event_data_mutable(track->events[1]);
+	note[1] += 12;
+	track_mark_dirty(track);
+	assert(!midi_equal(m, clone) && midi_equal(m, original));
+
+	//the clone outlives the Midi it came from
+	struct Midi* again = midi_clone(clone);
+	free_midi(m);
+	free(m);
+	assert(midi_track(again, 0)->refs == 2 && midi_track(again, 1) == track && track->refs == 2);
+	size_t size = 0;
+	uint8_t* data = write_midi_to_buffer(again, 0, NULL, &size);
+	struct Midi* back = read_midi_buffer(data, size);
+	assert(back && midi_equal(back, clone));
+	assert(midi_event_data(midi_track(back, 1)->events[1])[1] == midi_event_data(midi_track(original, 1)->events[1])[1] + 12);
+	free_midi(back);
+	free(back);
+	free(data);
+	free_midi(clone);
+	free(clone);
+	free_midi(again);
+	free(again);
+
+	//variants changing the same track on several threads each get their own copy
+	pthread_t threads[4];
+	for(size_t i = 0; i < 4; ++i){
+		assert(!pthread_create(&threads[i], NULL, transpose_clone_worker, midi_clone(original)));
+	}
+	for(size_t i = 0; i < 4; ++i){
+		pthread_join(threads[i], NULL);
+	}
+	assert(midi_track(original, 1)->refs == 1);
+
+	//clones sharing their tracks are written on several threads, without anything the tracks cache changing
+	for(size_t i = 0; i < 4; ++i){
+		assert(!pthread_create(&threads[i], NULL, write_clone_worker, midi_clone(original)));
+	}
+	for(size_t i = 0; i < 4; ++i){
+		pthread_join(threads[i], NULL);
+	}
+	assert(midi_track(original, 1)->refs == 1 && !midi_track(original, 1)->serialized);
+
+	//long events are copied, unless they can be shared through a pool
+	struct MidiPayloadPool pool;
+	new_payload_pool(&pool);
+	struct Midi* pooled = malloc(sizeof(struct Midi));
+	new_midi(pooled);
+	midi_add_header(pooled, 0, 1, 96);
+	struct MidiTrackChunk* plain = midi_add_track(pooled);
+	pooled->pool = &pool;
+	struct MidiTrackChunk* shared_payloads = midi_add_track(pooled);
+	uint8_t text[20] = {0xFF, 0x01, 17, 'a', 'l', 'l', ' ', 'v', 'a', 'r', 'i', 'a', 'n', 't', 's', ' ', 'a', 'g', 'r', 'e'};
+	track_add_event_full(plain, 0, text, sizeof(text));
+	track_add_event_full(shared_payloads, 0, text, sizeof(text));
+	clone = midi_clone(pooled);
+	assert(midi_event_data(midi_track_writable(clone, 0)->events[0]) != midi_event_data(plain->events[0]));
+	assert(midi_event_data(midi_track_writable(clone, 1)->events[0]) == midi_event_data(shared_payloads->events[0]));
+	assert(midi_equal(pooled, clone));
+	struct MidiPoolStats stats;
+	payload_pool_stats(&pool, &stats);
+	assert(stats.payloads == 1 && stats.references == 2);
+	free_midi(pooled);
+	free(pooled);
+	free_midi(clone);
+	free(clone);
+	payload_pool_stats(&pool, &stats);
+	assert(!stats.payloads && !stats.references);
+	free_payload_pool(&pool);
+
+	//an arena backed Midi cannot be shared
+	struct Midi arena;
+	new_midi_arena(&arena, 0);
+	assert(!midi_clone(&arena));
+	free_midi(&arena);
+
+	free_midi(original);
+	free(original);
+	printf("Cloned and copied 1 track on write\n");
+}
+
+/*
+ * Adds a deterministic mix of every kind of event to `track`, ending it
+ */
+static void add_transform_events(struct MidiTrackChunk* track, size_t count){
+	uint32_t r = 1;
+	uint8_t text[8] = {0xFF, 0x01, 5, 'v', 'o', 'i', 'c', 'e'};
+	uint8_t sysex[6] = {0xF0, 4, 0x7E, 0x7F, 0x09, 0xF7};
+	uint8_t end[3] = {0xFF, 0x2F, 0x00};
+	for(size_t i = 0; i < count; ++i){
+		r = r * 1103515245 + 12345;
+		uint8_t kind = (uint8_t) (0x8 + i % 9);
+		uint8_t ev[3] = {(uint8_t) ((kind << 4) | ((r >> 8) & 0x0F)), (uint8_t) ((r >> 16) & 0x7F), (uint8_t) ((r >> 24) & 0x7F)};
+		if(kind == 0xF){
+			track_add_event_full(track, r & 0x3F, text, sizeof(text));
+		} else if(kind == 0x10){
+			track_add_event_full(track, r & 0x3F, sysex, sizeof(sysex));
+		} else {
+			track_add_event_full(track, r & 0x3F, ev, (kind == 0xC || kind == 0xD) ? 2 : 3);
+		}
+	}
+	track_add_event_full(track, 0, end, sizeof(end));
+}
+
+static void apply_transforms(struct MidiEventColumns* columns){
+	uint8_t curve[128];
+	uint8_t map[16];
+	for(int v = 0; v < 128; ++v){
+		curve[v] = (uint8_t) (127 - v);
+	}
+	for(int c = 0; c < 16; ++c){
+		map[c] = (uint8_t) (15 - c);
+	}
+	event_columns_transpose(columns, 5, 0x00FF);
+	event_columns_transpose(columns, -70, ALL_CHANNELS);
+	event_columns_velocity_scale(columns, 200, -3);
+	event_columns_velocity_curve(columns, curve);
+	event_columns_channel_remap(columns, map);
+	event_columns_filter(columns, CLASS_ALL & ~CLASS_PITCH_BEND);
+	event_columns_filter(columns, CLASS_ALL & ~CLASS_SYSEX & ~CLASS_META);
+}
+
+void test_transform(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 1, 2, 96);
+	struct MidiTrackChunk* track = midi_add_track(m);
+	add_transform_events(track, 203);
+
+	//every instruction set the CPU has gives the same columns as the scalar kernels
+	struct MidiEventColumns scalar;
+	new_event_columns(&scalar);
+	transform_set_isa(TRANSFORM_ISA_SCALAR);
+	event_columns_from_track(&scalar, track);
+	apply_transforms(&scalar);
+	int isas = 1;
+	for(int isa = TRANSFORM_ISA_SSE2; isa <= TRANSFORM_ISA_AVX2; ++isa){
+		if(transform_set_isa(isa) != isa){
+			continue;
+		}
+		struct MidiEventColumns columns;
+		new_event_columns(&columns);
+		event_columns_from_track(&columns, track);
+		apply_transforms(&columns);
+		assert(columns.count == scalar.count);
+		assert(!memcmp(columns.status, scalar.status, scalar.count) && !memcmp(columns.data1, scalar.data1, scalar.count));
+		assert(!memcmp(columns.data2, scalar.data2, scalar.count) && !memcmp(columns.keep, scalar.keep, scalar.count));
+		free_event_columns(&columns);
+		isas++;
+	}
+	transform_set_isa(-1);
+
+	//storing drops the filtered events without moving the rest in time
+	const uint64_t* ticks = track_ticks(track);
+	uint64_t* kept_ticks = malloc(sizeof(uint64_t) * scalar.count);
+	size_t kept = 0;
+	for(size_t i = 0; i < scalar.count; ++i){
+		if(scalar.keep[i]){
+			kept_ticks[kept++] = ticks[i];
+		}
+	}
+	event_columns_to_track(&scalar, track);
+	assert(track->event_count == kept && track->dirty);
+	ticks = track_ticks(track);
+	for(size_t i = 0; i < kept; ++i){
+		const uint8_t* data = midi_event_data(track->events[i]);
+		assert(ticks[i] == kept_ticks[i] && (data[0] & 0xF0) != 0xE0 && data[0] != 0xF0 && (data[0] != 0xFF || data[1] == 0x2F));
+	}
+	assert(midi_event_data(track->events[kept - 1])[1] == 0x2F);
+	free(kept_ticks);
+
+	//a curve reaching 0 or past 127 is clamped to a valid velocity on every instruction set
+	struct MidiTrackChunk velocities;
+	new_midi_track(&velocities);
+	uint8_t curve[128];
+	for(uint8_t v = 0; v < 128; ++v){
+		uint8_t ev[3] = {0x95, 60, v};
+		track_add_event_full(&velocities, 0, ev, 3);
+		curve[v] = v < 64 ? 0 : 200;
+	}
+	for(int isa = TRANSFORM_ISA_SCALAR; isa <= TRANSFORM_ISA_AVX2; ++isa){
+		if(transform_set_isa(isa) != isa){
+			continue;
+		}
+		struct MidiEventColumns columns;
+		new_event_columns(&columns);
+		event_columns_from_track(&columns, &velocities);
+		event_columns_velocity_curve(&columns, curve);
+		for(uint8_t v = 0; v < 128; ++v){
+			assert(columns.data2[v] == (v == 0 ? 0 : v < 64 ? 1 : 127));
+		}
+		free_event_columns(&columns);
+	}
+	transform_set_isa(-1);
+	free_midi_track(&velocities);
+
+	//the semantics on a few events
+	struct MidiTrackChunk* notes = midi_add_track(m);
+	uint8_t events[5][3] = {{0x92, 60, 100}, {0x93, 60, 100}, {0xE2, 0x00, 0x40}, {0x92, 60, 0}, {0xFF, 0x2F, 0x00}};
+	for(size_t i = 0; i < 5; ++i){
+		track_add_event_full(notes, 10, events[i], 3);
+	}
+	size_t size = 0;
+	uint8_t* data = write_midi_to_buffer(m, 0, NULL, &size);
+	struct Midi* borrowed = read_midi_buffer(data, size);
+	notes = midi_track(borrowed, 1);
+	assert(notes->events[0]->storage == EVENT_STORAGE_BORROWED);
+	struct MidiEventColumns columns;
+	new_event_columns(&columns);
+	event_columns_from_track(&columns, notes);
+	event_columns_transpose(&columns, 5, 1 << 2);
+	event_columns_velocity_scale(&columns, 256, 0);
+	assert(event_columns_filter(&columns, CLASS_NOTE_ON) == 4);
+	event_columns_to_track(&columns, notes);
+	assert(notes->event_count == 4 && notes->events[2]->delta_time == 20);
+	assert(!memcmp(midi_event_data(notes->events[0]), "\x92\x41\x7F", 3) && notes->events[0]->storage == EVENT_STORAGE_INLINE);
+	assert(!memcmp(midi_event_data(notes->events[1]), "\x93\x3C\x7F", 3));
+	assert(!memcmp(midi_event_data(notes->events[2]), "\x92\x41\x00", 3));
+	//the buffer the events were read from is left alone
+	struct Midi* unchanged = read_midi_buffer(data, size);
+	assert(midi_track(unchanged, 1)->event_count == 5);
+	free_midi(unchanged);
+	free(unchanged);
+
+	//packed tracks give the same result
+	struct MidiPackedTrack packed;
+	new_packed_track(&packed);
+	packed_track_from_track(&packed, midi_track(m, 1));
+	event_columns_from_packed(&columns, &packed);
+	event_columns_transpose(&columns, 5, 1 << 2);
+	event_columns_velocity_scale(&columns, 256, 0);
+	event_columns_filter(&columns, CLASS_NOTE_ON);
+	event_columns_to_packed(&columns, &packed);
+	assert(packed.event_count == notes->event_count && packed.pool_len == 3 * notes->event_count);
+	for(size_t i = 0; i < packed.event_count; ++i){
+		size_t len;
+		const uint8_t* ev = packed_track_event(&packed, i, &len);
+		assert(len == 3 && !memcmp(ev, midi_event_data(notes->events[i]), 3) && packed.delta_time[i] == notes->events[i]->delta_time);
+	}
+	free_packed_track(&packed);
+	free_event_columns(&columns);
+	free_event_columns(&scalar);
+	free_midi(borrowed);
+	free(borrowed);
+	free(data);
+	free_midi(m);
+	free(m);
+	printf("Transformed events with %d instruction sets\n", isas);
+}
+
+void test_quantize(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 1, 2, 96);
+	struct MidiTrackChunk* track = midi_add_track(m);
+	//a note at 13 for 27 ticks, a controller, a note at 50 ended by a note on with velocity 0 and a note never ended
+	uint8_t events[6][3] = {{0x90, 60, 100}, {0xB0, 7, 100}, {0x80, 60, 0}, {0x91, 64, 90}, {0x91, 64, 0}, {0x92, 67, 80}};
+	uint32_t deltas[6] = {13, 7, 20, 10, 10, 35};
+	for(size_t i = 0; i < 6; ++i){
+		track_add_event_full(track, deltas[i], events[i], 3);
+	}
+	uint8_t end[3] = {0xFF, 0x2F, 0x00};
+	track_add_event_full(track, 1, end, sizeof(end));
+	struct MidiTrackChunk* other = midi_add_track(m);
+	for(uint32_t i = 0; i < 1000; ++i){
+		uint8_t ev[3] = {(uint8_t) (0x90 | (i & 0x0F)), (uint8_t) (i & 0x7F), (uint8_t) ((i & 1) ? 0 : 64)};
+		track_add_event_full(other, (i * 7919) % 101, ev, 3);
+	}
+	track_add_event_full(other, 0, end, sizeof(end));
+
+	//rescaling goes from the absolute ticks, so there is no drift and going back up to a multiple is exact
+	uint64_t before[2000];
+	memcpy(before, track_ticks(other), sizeof(uint64_t) * other->event_count);
+	struct Midi* copy = midi_clone(m);
+	assert(!midi_rescale_division(copy, 960) && !midi_rescale_division(copy, 96) && copy->header->division == 96);
+	assert(midi_equal(m, copy) && midi_track(copy, 1) != other);
+	assert(!midi_rescale_division(copy, 100) && copy->header->division == 100 && m->header->division == 96);
+	const uint64_t* ticks = track_ticks(midi_track(copy, 1));
+	for(size_t i = 0; i < other->event_count; ++i){
+		assert(ticks[i] == (before[i] * 100 + 48) / 96);
+	}
+	assert(midi_rescale_division(copy, 0x8000 | 25) == -1 && midi_rescale_division(copy, 0) == -1);
+
+	//a delta time which would not fit is refused without changing any track
+	uint8_t note[3] = {0x90, 1, 1};
+	track_add_event_full(midi_track_writable(copy, 0), 0x0FFFFFF0, note, sizeof(note));
+	assert(midi_rescale_division(copy, 200) == -1 && copy->header->division == 100);
+	struct Midi* shared = midi_clone(copy);
+	assert(midi_rescale_division(shared, 200) == -1 && midi_track(shared, 1) == midi_track(copy, 1) && midi_track(copy, 1)->refs == 2);
+	//a shared track is refused too, rather than changed under every clone
+	assert(track_quantize(midi_track(shared, 1), 24) == -1 && track_rescale_division(midi_track(shared, 1), 100, 50) == -1);
+	assert(midi_equal(shared, copy));
+	free_midi(shared);
+	free(shared);
+	size_t last = other->event_count - 1;
+	assert(track_ticks(midi_track(copy, 1))[last] == (before[last] * 100 + 48) / 96);
+	free_midi(copy);
+	free(copy);
+
+	//note ons move to the grid and their note offs move with them, and the events keep their order, so the
+	//controller and the note at 50 are held at the tick of the event before them
+	copy = midi_clone(m);
+	assert(!midi_quantize(copy, 24) && midi_quantize(copy, 0) == -1);
+	ticks = track_ticks(midi_track(copy, 0));
+	uint64_t quantized[7] = {24, 24, 51, 51, 58, 96, 96};
+	assert(!memcmp(ticks, quantized, sizeof(quantized)));
+	for(size_t i = 0; i < 7; ++i){
+		assert(!memcmp(midi_event_data(midi_track(copy, 0)->events[i]), i == 6 ? end : events[i], 3));
+	}
+
+	//a note off is held back rather than ending the next note of the same pitch
+	struct MidiTrackChunk restruck;
+	new_midi_track(&restruck);
+	uint8_t restrike[3][3] = {{0x90, 60, 100}, {0x80, 60, 0}, {0x90, 60, 100}};
+	uint32_t restrike_deltas[3] = {13, 32, 5};
+	for(size_t i = 0; i < 3; ++i){
+		track_add_event_full(&restruck, restrike_deltas[i], restrike[i], 3);
+	}
+	assert(!track_quantize(&restruck, 24));
+	ticks = track_ticks(&restruck);
+	assert(ticks[0] == 24 && ticks[1] == 48 && ticks[2] == 48 && midi_event_data(restruck.events[1])[0] == 0x80);
+	free_midi_track(&restruck);
+
+	//the tracks are independent, so doing them in parallel gives the same result
+	struct Midi* parallel = midi_clone(m);
+	assert(!midi_quantize_parallel(parallel, 24, 4) && midi_equal(copy, parallel));
+	assert(!midi_rescale_division(copy, 480) && !midi_rescale_division_parallel(parallel, 480, 0));
+	assert(midi_equal(copy, parallel) && parallel->header->division == 480);
+	free_midi(parallel);
+	free(parallel);
+	free_midi(copy);
+	free(copy);
+
+	assert(!track_rescale_division(track, 96, 48) && track_ticks(track)[2] == 20 && track_rescale_division(track, 0, 48) == -1);
+	//ticks past 31 bits are divided the slow way, with the same results
+	struct MidiTrackChunk long_track;
+	new_midi_track(&long_track);
+	for(size_t i = 0; i < 12; ++i){
+		track_add_event_full(&long_track, 0x0FFFFFFF - (uint32_t) i, note, sizeof(note));
+	}
+	memcpy(before, track_ticks(&long_track), sizeof(uint64_t) * 12);
+	assert(before[11] >= (uint64_t) 1 << 31 && !track_rescale_division(&long_track, 96, 95));
+	for(size_t i = 0; i < 12; ++i){
+		assert(track_ticks(&long_track)[i] == (before[i] * 95 + 48) / 96);
+	}
+	free_midi_track(&long_track);
+	size_t count = track->event_count + other->event_count;
+	free_midi(m);
+	free(m);
+	printf("Rescaled and quantized %zu events\n", count);
+}
+
+static struct Midi* read_midi_threads(FILE* f){
+	return read_midi_parallel(f, 2);
+}
+
+void test_parallel(){
+	FILE* f = fopen("writer.mid", "rb");
+	struct Midi* m = read_midi(f);
+	rewind(f);
+	struct Midi* parallel = read_midi_parallel(f, 4);
+	fclose(f);
+	assert(parallel && midi_equal(m, parallel));
+	free_midi(parallel);
+	free(parallel);
+	free_midi(m);
+	free(m);
+
+	f = fopen("test.mid", "rb");
+	m = read_midi(f);
+	rewind(f);
+	parallel = read_midi_parallel(f, 0);
+	fclose(f);
+	f = NULL;
+	assert(parallel && midi_equal(m, parallel));
+	printf("Read test.mid in parallel\n");
+	free_midi(parallel);
+	free(parallel);
+
+	//every reader skips a chunk which is not a track
+	size_t size = 0;
+	uint8_t* written = write_midi_to_buffer(m, 0, NULL, &size);
+	size_t first_track = 14 + 8 + load_uint32_t(written + 14 + 4);
+	uint8_t unknown[11] = {'X', 'U', 'N', 'K', 0, 0, 0, 3, 0x90, 0x3C, 0x40};
+	uint8_t* data = malloc(size + sizeof(unknown));
+	memcpy(data, written, first_track);
+	memcpy(data + first_track, unknown, sizeof(unknown));
+	memcpy(data + first_track + sizeof(unknown), written + first_track, size - first_track);
+	size += sizeof(unknown);
+	free(written);
+
+	struct Midi* read = read_midi_buffer(data, size);
+	assert(read && midi_equal(m, read));
+	free_midi(read);
+	free(read);
+	read = read_midi_buffer_lazy(data, size);
+	assert(read && midi_equal(m, read));
+	free_midi(read);
+	free(read);
+	struct Midi* (*file_readers[3])(FILE*) = {read_midi, read_midi_arena, read_midi_threads};
+	for(size_t i = 0; i < 3; ++i){
+		f = tmpfile();
+		fwrite(data, 1, size, f);
+		rewind(f);
+		read = file_readers[i](f);
+		fclose(f);
+		assert(read && midi_equal(m, read));
+		free_midi(read);
+		free(read);
+	}
+	struct MidiReader reader;
+	assert(!midi_reader_open_buffer(&reader, data, size));
+	check_reader(&reader, m);
+	midi_reader_close(&reader);
+	free(data);
+
+	free_midi(m);
+	free(m);
+}
+
+void test_merge(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 1, 3, 96);
+	uint8_t end[3] = {0xFF, META_END_OF_TRACK, 0x00};
+	size_t total = 0;
+	for(uint8_t t = 0; t < 3; ++t){
+		struct MidiTrackChunk* track = midi_add_track(m);
+		for(uint8_t i = 0; i < 50; ++i){
+			//the tracks step at different rates so they interleave, and meet at multiples of 30
+			uint8_t ev[3] = {VOICE_NOTE_ON | t, i, 0x40};
+			track_add_event_full(track, i ? 5 * (t + 1) : 0, ev, 3);
+		}
+		track_add_event_full(track, 7, end, 3);
+		total += track->event_count;
+	}
+
+	struct MidiMerge merge;
+	midi_merge_open(&merge, m);
+	struct MidiMergeEvent ev;
+	size_t count = 0;
+	uint64_t tick = 0;
+	uint16_t last_track = 0;
+	size_t last_index[3] = {0};
+	while(midi_merge_next(&merge, &ev)){
+		assert(ev.tick >= tick);
+		assert(ev.tick == tick + ev.delta_time);
+		//ties go by track, then by order within the track
+		assert(ev.tick > tick || !count || ev.track >= last_track);
+		assert(!ev.index || ev.index == last_index[ev.track] + 1);
+		assert(ev.event == ((struct MidiTrackChunk*) m->chunks[ev.track + 1]->chunk)->events[ev.index]);
+		tick = ev.tick;
+		last_track = ev.track;
+		last_index[ev.track] = ev.index;
+		count++;
+	}
+	midi_merge_close(&merge);
+	assert(count == total);
+
+	FILE* f = fopen("flat.mid", "wb");
+	assert(!midi_flatten_to_format0(m, f, WRITE_RUNNING_STATUS));
+	fclose(f);
+	f = fopen("flat.mid", "rb");
+	struct Midi* flat = read_midi(f);
+	fclose(f);
+	assert(flat->chunk_count == 2);
+	struct MidiHeaderChunk* header = (struct MidiHeaderChunk*) flat->chunks[0]->chunk;
+	assert(header->format == 0 && header->tracks == 1 && header->division == 96);
+	struct MidiTrackChunk* track = (struct MidiTrackChunk*) flat->chunks[1]->chunk;
+	//one end of track instead of three, at the end of the longest track
+	assert(track->event_count == total - 2);
+	const uint64_t* ticks = track_ticks(track);
+	assert(ticks[track->event_count - 1] == 49 * 15 + 7);
+	assert(midi_event_data(track->events[track->event_count - 1])[1] == META_END_OF_TRACK);
+	printf("Flattened %zu events from 3 tracks\n", track->event_count);
+
+	free_midi(flat);
+	free(flat);
+	free_midi(m);
+	free(m);
+}
+
+void test_tempo(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 1, 2, 480);
+	struct MidiTrackChunk* tempo_track = midi_add_track(m);
+	uint8_t tempo_fast[6] = {0xFF, META_SET_TEMPO, 0x03, 0x03, 0xD0, 0x90}; //250000
+	uint8_t tempo_slow[6] = {0xFF, META_SET_TEMPO, 0x03, 0x0F, 0x42, 0x40}; //1000000
+	track_add_event_full(tempo_track, 960, tempo_slow, 6);
+	//replaces the change just before it
+	track_add_event_full(tempo_track, 0, tempo_fast, 6);
+	struct MidiTrackChunk* track = midi_add_track(m);
+	uint8_t ev[3] = {0x90, 0x3C, 0x40};
+	for(size_t i = 0; i < 10; ++i){
+		track_add_event_full(track, 240, ev, 3);
+	}
+	//only the first track sets the tempo of a format 1 file
+	track_add_event_full(track, 0, tempo_slow, 6);
+
+	struct MidiTempoMap map;
+	assert(!new_tempo_map(&map, m));
+	assert(map.segment_count == 2);
+	assert(tempo_map_tick_to_us(&map, 0) == 0);
+	assert(tempo_map_tick_to_us(&map, 480) == 500000);
+	assert(tempo_map_tick_to_us(&map, 960) == 1000000);
+	assert(tempo_map_tick_to_us(&map, 1920) == 1500000);
+	assert(tempo_map_tick_to_us(&map, 2400) == 1750000);
+	assert(tempo_map_tick_to_us(&map, 2401) == 1750520);
+	assert(tempo_map_us_to_tick(&map, 1750519) == 2400);
+	for(uint64_t tick = 0; tick < 5000; tick += 7){
+		assert(tempo_map_us_to_tick(&map, tempo_map_tick_to_us(&map, tick)) == tick);
+	}
+
+	//the batch conversions match one at a time conversions, sorted or not
+	uint64_t ticks[8] = {0, 100, 960, 961, 3000, 5, 2399, 1920};
+	uint64_t us[8];
+	uint64_t back[8];
+	tempo_map_ticks_to_us(&map, ticks, us, 8);
+	tempo_map_us_to_ticks(&map, us, back, 8);
+	for(size_t i = 0; i < 8; ++i){
+		assert(us[i] == tempo_map_tick_to_us(&map, ticks[i]));
+		assert(back[i] == ticks[i]);
+	}
+	uint64_t* event_us = malloc(sizeof(uint64_t) * track->event_count);
+	tempo_map_track_to_us(&map, track, event_us);
+	assert(event_us[1] == 500000 && event_us[9] == 1750000);
+	free(event_us);
+	free_tempo_map(&map);
+
+	//each track of a format 2 file is mapped on its own
+	m->header->format = 2;
+	assert(new_tempo_map(&map, m) == -1);
+	free_tempo_map(&map);
+	assert(!new_tempo_map_track(&map, m, 1));
+	assert(map.segment_count == 2);
+	assert(tempo_map_tick_to_us(&map, 2400) == 2500000 && tempo_map_tick_to_us(&map, 2880) == 3500000);
+	free_tempo_map(&map);
+	assert(new_tempo_map_track(&map, m, 2) == -1);
+	free_tempo_map(&map);
+	m->header->format = 1;
+
+	//25 frames per second with 40 ticks per frame
+	m->header->division = (uint16_t) ((uint8_t) -25 << 8 | 40);
+	assert(!new_tempo_map(&map, m));
+	assert(map.segment_count == 1);
+	assert(tempo_map_tick_to_us(&map, 1000) == 1000000);
+	free_tempo_map(&map);
+	//30 drop frame
+	m->header->division = (uint16_t) ((uint8_t) -29 << 8 | 1);
+	assert(!new_tempo_map(&map, m));
+	assert(tempo_map_tick_to_us(&map, 30) == 1001000);
+	assert(tempo_map_us_to_tick(&map, 1001000) == 30);
+	free_tempo_map(&map);
+	printf("Converted ticks with tempo changes and SMPTE divisions\n");
+
+	free_midi(m);
+	free(m);
+}
+
+/*
+ * Seeks `reader` to `tick` in `track`, and checks that skipping ahead from the checkpoint lands on the same event
+ * as the decoded `Midi` does
+ */
+void check_seek(struct MidiReader* reader, const struct MidiSeekIndex* index, struct Midi* m, uint16_t track, uint64_t tick){
+	struct MidiTrackChunk* t = (struct MidiTrackChunk*) m->chunks[track + 1]->chunk;
+	size_t expected = track_find_tick(t, tick);
+	const struct MidiSeekPoint* point = midi_reader_seek(reader, index, track, tick);
+	assert(point && point->event <= expected);
+	assert(expected - point->event <= index->interval || expected == t->event_count);
+
+	struct MidiReaderEvent ev;
+	uint64_t at = point->tick;
+	size_t i = point->event;
+	while(midi_reader_next_event(reader, &ev) == 1 && ev.track == track){
+		at += ev.delta_time;
+		if(at >= tick){
+			break;
+		}
+		i++;
+	}
+	assert(i == expected);
+	if(i < t->event_count){
+		assert(ev.event_len == t->events[i]->event_len);
+		assert(!memcmp(ev.event, midi_event_data(t->events[i]), ev.event_len));
+	}
+}
+
+void test_seek(){
+	//compact.mid uses running status all through its tracks
+	struct MidiMap* map = open_midi_mmap("compact.mid");
+	assert(map);
+	struct MidiSeekIndex index;
+	assert(!new_seek_index(&index, map->data, map->size, 100));
+	assert(index.track_count == map->midi->header->tracks);
+
+	FILE* f = fopen("compact.mid.idx", "wb");
+	assert(!write_seek_index(&index, f));
+	fclose(f);
+	f = fopen("compact.mid.idx", "rb");
+	struct MidiSeekIndex loaded;
+	assert(!read_seek_index(&loaded, f));
+	fclose(f);
+	assert(loaded.interval == 100 && loaded.track_count == index.track_count);
+	for(uint16_t i = 0; i < index.track_count; ++i){
+		assert(loaded.tracks[i].point_count == index.tracks[i].point_count);
+		assert(!memcmp(&loaded.tracks[i].points[index.tracks[i].point_count - 1], &index.tracks[i].points[index.tracks[i].point_count - 1], sizeof(uint64_t) * 2));
+	}
+	free_seek_index(&loaded);
+
+	struct MidiReader reader;
+	assert(!midi_reader_open_buffer(&reader, map->data, map->size));
+	f = fopen("compact.mid", "rb");
+	struct MidiReader file_reader;
+	assert(!midi_reader_open_file(&file_reader, f));
+	uint16_t track = (uint16_t) (index.track_count - 1);
+	struct MidiTrackChunk* t = (struct MidiTrackChunk*) map->midi->chunks[track + 1]->chunk;
+	uint64_t last = track_ticks(t)[t->event_count - 1];
+	for(uint64_t tick = 0; tick <= last + 1; tick += last / 37 + 1){
+		check_seek(&reader, &index, map->midi, track, tick);
+		check_seek(&file_reader, &index, map->midi, track, tick);
+	}
+	check_seek(&reader, &index, map->midi, 0, 0);
+	check_seek(&file_reader, &index, map->midi, track, last);
+	printf("Seeked through %zu checkpoints\n", index.tracks[track].point_count);
+	midi_reader_close(&file_reader);
+	fclose(f);
+	midi_reader_close(&reader);
+
+	free_seek_index(&index);
+	close_midi_mmap(map);
+}
+
+void test_notes(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 1, 2, 96);
+	struct MidiTrackChunk* a = midi_add_track(m);
+	struct MidiTrackChunk* b = midi_add_track(m);
+	uint8_t on[3] = {VOICE_NOTE_ON | CHANNEL_1, NOTE_C4, 0x40};
+	uint8_t off[3] = {VOICE_NOTE_OFF | CHANNEL_1, NOTE_C4, 0x40};
+	uint8_t on_zero[3] = {VOICE_NOTE_ON | CHANNEL_1, NOTE_C4, 0x00};
+	//two overlapping C4s, the inner one ends first
+	track_add_event_full(a, 0, on, 3);
+	track_add_event_full(a, 10, on, 3);
+	track_add_event_full(a, 10, off, 3);
+	track_add_event_full(a, 10, on_zero, 3);
+	//an off with nothing to end
+	track_add_event_full(a, 10, off, 3);
+	//the other track's D4 on another channel is never ended
+	uint8_t d[3] = {VOICE_NOTE_ON | CHANNEL_2, NOTE_D4, 0x50};
+	track_add_event_full(b, 5, d, 3);
+	uint8_t end[3] = {0xFF, META_END_OF_TRACK, 0x00};
+	track_add_event_full(b, 95, end, 3);
+
+	struct MidiNotes notes;
+	new_midi_notes(&notes, m);
+	assert(notes.count == 3);
+	assert(notes.start[0] == 0 && notes.end[0] == 30 && notes.track[0] == 0);
+	assert(notes.start[1] == 5 && notes.end[1] == 100 && notes.pitch[1] == NOTE_D4 && notes.channel[1] == CHANNEL_2);
+	assert(notes.start[2] == 10 && notes.end[2] == 20 && notes.velocity[2] == 0x40);
+	size_t found[3];
+	assert(midi_notes_sounding(&notes, 0, 5, found, 3) == 1 && found[0] == 0);
+	assert(midi_notes_sounding(&notes, 20, 21, found, 3) == 2 && found[0] == 0 && found[1] == 1);
+	assert(midi_notes_sounding(&notes, 30, 1000, NULL, 0) == 1);
+	free_midi_notes(&notes);
+	free_midi(m);
+	free(m);
+
+	//many random notes against checking every one
+	m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	midi_add_header(m, 0, 1, 96);
+	struct MidiTrackChunk* track = midi_add_track(m);
+	srand(7);
+	for(size_t i = 0; i < 4000; ++i){
+		//one call per statement, since the order calls within an expression are made in is unspecified
+		int status = rand() % 2 ? VOICE_NOTE_ON : VOICE_NOTE_OFF;
+		int channel = rand() % 4;
+		int pitch = 60 + rand() % 8;
+		int velocity = 1 + rand() % 127;
+		uint32_t delta_time = (uint32_t) (rand() % 20);
+		uint8_t ev[3] = {(uint8_t) (status | channel), (uint8_t) pitch, (uint8_t) velocity};
+		track_add_event_full(track, delta_time, ev, 3);
+	}
+	new_midi_notes(&notes, m);
+	size_t* out = malloc(sizeof(size_t) * (notes.count + 1));
+	for(uint64_t t0 = 0; t0 < 40000; t0 += 997){
+		uint64_t t1 = t0 + 1 + (t0 % 500);
+		size_t count = midi_notes_sounding(&notes, t0, t1, out, notes.count);
+		size_t expected = 0;
+		for(size_t i = 0; i < notes.count; ++i){
+			if(notes.start[i] < t1 && notes.end[i] > t0){
+				assert(expected < count && out[expected] == i);
+				expected++;
+			}
+		}
+		assert(count == expected);
+	}
+	printf("Paired %zu notes\n", notes.count);
+	free(out);
+	free_midi_notes(&notes);
+	free_midi(m);
+	free(m);
+}
+
+void test_play(){
+	struct Midi* m = malloc(sizeof(struct Midi));
+	new_midi(m);
+	//at the default tempo each tick is 5ms
+	midi_add_header(m, 1, 2, 100);
+	struct MidiTrackChunk* a = midi_add_track(m);
+	struct MidiTrackChunk* b = midi_add_track(m);
+	uint8_t ev[3] = {VOICE_NOTE_ON, NOTE_C4, 0x40};
+	for(size_t i = 0; i < 10; ++i){
+		track_add_event_full(a, 2, ev, 3);
+		track_add_event_full(b, i ? 2 : 1, ev, 3);
+	}
+	uint8_t sysex[5] = {0xF0, 0x03, 0x7E, 0x7F, 0xF7};
+	track_add_event_full(a, 1, sysex, 5);
+	uint8_t end[3] = {0xFF, META_END_OF_TRACK, 0x00};
+	track_add_event_full(a, 0, end, 3);
+
+	struct MidiPlayRecorder recorder;
+	new_play_recorder(&recorder);
+	struct MidiPlayer player;
+	assert(!midi_player_start(&player, m, midi_play_sink_recorder, &recorder));
+	midi_player_wait(&player);
+	assert(recorder.count == 22 && player.stats.events == 22);
+	uint64_t start = (uint64_t) player.start.tv_sec * 1000000000 + (uint64_t) player.start.tv_nsec;
+	for(size_t i = 0; i < recorder.count; ++i){
+		//in time order, and never early
+		assert(!i || recorder.events[i].us >= recorder.events[i - 1].us);
+		assert(recorder.dispatched_ns[i] >= start + recorder.events[i].us * 1000);
+	}
+	assert(recorder.events[0].track == 1 && recorder.events[0].us == 5000);
+	assert(recorder.events[recorder.count - 1].us == 21 * 5000);
+	printf("Played %zu events, %zu late, max jitter %lluus\n", player.stats.events, player.stats.late,
+			(unsigned long long) player.stats.max_jitter_ns / 1000);
+	free_play_recorder(&recorder);
+
+	//the wire format through a pipe, without the meta event or the sysex length
+	int fds[2];
+	assert(!pipe(fds));
+	assert(!midi_player_start(&player, m, midi_play_sink_fd, &fds[1]));
+	midi_player_wait(&player);
+	close(fds[1]);
+	uint8_t wire[128];
+	ssize_t len = read(fds[0], wire, sizeof(wire));
+	close(fds[0]);
+	assert(len == 20 * 3 + 4);
+	assert(wire[60] == 0xF0 && wire[61] == 0x7E && wire[63] == 0xF7);
+
+	//stopping does not wait for the rest of the file
+	track_add_event_full(b, 100000, ev, 3);
+	new_play_recorder(&recorder);
+	assert(!midi_player_start(&player, m, midi_play_sink_recorder, &recorder));
+	midi_player_stop(&player);
+	assert(recorder.count < 22);
+	free_play_recorder(&recorder);
+
+	free_midi(m);
+	free(m);
+}
+
+// per worker event counts
+static void count_batch_events(const char* path, struct Midi* midi, unsigned worker, void* user){
+	size_t* counts = (size_t*) user;
+	if(!midi){
+		return;
+	}
+	for(uint32_t i = 0; i < midi->chunk_count; ++i){
+		if(midi->chunks[i]->type_e == CHUNK_TRACK){
+			counts[worker] += ((struct MidiTrackChunk*) midi->chunks[i]->chunk)->event_count;
+		}
+	}
+}
+
+void test_batch(){
+	const char* paths[] = {
+		"test.mid", "writer.mid", "arena.mid", "missing.mid", "packed.mid",
+		"stream.mid", "running.mid", "compact.mid", "writer_pipe.mid", "test.mid"
+	};
+	size_t count = sizeof(paths) / sizeof(paths[0]);
+
+	//the same files read one by one
+	size_t expected = 0;
+	uint64_t expected_bytes = 0;
+	for(size_t i = 0; i < count; ++i){
+		FILE* f = fopen(paths[i], "rb");
+		if(!f){
+			continue;
+		}
+		struct Midi* m = read_midi(f);
+		fseek(f, 0, SEEK_END);
+		expected_bytes += (uint64_t) ftell(f);
+		fclose(f);
+		count_batch_events(paths[i], m, 0, &expected);
+		free_midi(m);
+		free(m);
+	}
+
+	size_t counts[4] = {0};
+	struct MidiBatchStats stats;
+	assert(midi_batch_run(paths, count, 4, count_batch_events, counts, &stats) == 1);
+	assert(stats.files == count);
+	assert(stats.failed == 1);
+	assert(stats.bytes == expected_bytes);
+	assert(counts[0] + counts[1] + counts[2] + counts[3] == expected);
+
+	//more workers than files
+	memset(counts, 0, sizeof(counts));
+	assert(!midi_batch_run(paths, 1, 4, count_batch_events, counts, NULL));
+	assert(counts[0] + counts[1] + counts[2] + counts[3] > 0);
+	printf("Batch read %zu files (%zu failed) at %.0f files/sec\n", stats.files, stats.failed, stats.files_per_sec);
+}
+
 void test_errors(){
 	struct Midi* m = malloc(sizeof(struct Midi));
 	new_midi(m);
@@ -251,6 +1981,29 @@ void test_errors(){
 int main(){
 	test_varlen();
 	test_read_write();
+	test_mmap();
+	test_lazy();
+	test_arena();
+	test_packed();
+	test_inline_events();
+	test_reserve();
+	test_ticks();
+	test_stream();
+	test_writer();
+	test_running_status();
+	test_write_buffer();
+	test_serialized();
+	test_pool();
+	test_clone();
+	test_transform();
+	test_quantize();
+	test_parallel();
+	test_batch();
+	test_merge();
+	test_tempo();
+	test_seek();
+	test_notes();
+	test_play();
 	test_helper_midi();
 
 	//test_errors();